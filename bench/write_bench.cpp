@@ -0,0 +1,183 @@
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <docker-plugin-cpp/plugin.h>
+#include <docker-plugin-cpp/volume/api.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace docker_plugin;
+
+/**
+ * Socket syscalls the plugin makes per request. The library is linked statically, so the functions
+ * below take the place of the libc wrappers it calls and count them. A client process sends the
+ * requests, only the plugin side is reported. Ideally a response is a single sendmsg, no matter
+ * how large it is, and pipelined requests share one.
+ */
+namespace {
+	std::atomic<uint64_t> g_sends{0};
+	std::atomic<uint64_t> g_epoll_ctls{0};
+	std::atomic<uint64_t> g_epoll_waits{0};
+
+	const char socket_path[] = "/run/docker/plugins/dpcpp-write-bench.sock";
+
+	struct bench_driver : volume::driver {
+		std::string m_large = "/mnt/" + std::string(64 * 1024, 'x');
+
+		error_response create(const volume::create_request&) override { return {}; }
+		volume::list_response list(const empty_type&) override { return {}; }
+		volume::get_response get(const volume::get_request&) override { return {}; }
+		error_response remove(const volume::remove_request&) override { return {}; }
+		volume::path_response path(const volume::path_request&) override { return {}; }
+		volume::mount_response mount(const volume::mount_request& req) override { return {req.name == "large" ? m_large : "/mnt/" + req.name}; }
+		error_response unmount(const volume::unmount_request&) override { return {}; }
+		volume::capabilities_response capabilities(const empty_type&) override { return {}; }
+	};
+
+	std::string mount_request(const std::string& name) {
+		auto body = "{\"Name\":\"" + name + "\",\"ID\":\"4f0c0f6e1c2d4f3b\"}";
+		return "POST /VolumeDriver.Mount HTTP/1.1\r\nHost: plugin\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	}
+
+	// Blocking client, runs in the child process
+	class client {
+		int m_fd;
+		std::string m_input{};
+
+	public:
+		client()
+			: m_fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)} {
+			sockaddr_un addr{};
+			addr.sun_family = AF_UNIX;
+			strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+			if (connect(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+				perror("connect");
+				_exit(1);
+			}
+		}
+		~client() { close(m_fd); }
+		client(const client&) = delete;
+		client& operator=(const client&) = delete;
+
+		void send_all(const std::string& data) {
+			for (size_t sent = 0; sent < data.size();) {
+				auto res = ::write(m_fd, data.data() + sent, data.size() - sent);
+				if (res <= 0) _exit(1);
+				sent += res;
+			}
+		}
+
+		void read_response() {
+			for (;;) {
+				auto head_end = m_input.find("\r\n\r\n");
+				if (head_end != std::string::npos) {
+					auto pos = m_input.find("content-length: ");
+					if (pos == std::string::npos || pos > head_end) _exit(1);
+					auto total = head_end + 4 + strtoull(m_input.c_str() + pos + 16, nullptr, 10);
+					if (m_input.size() >= total) {
+						m_input.erase(0, total);
+						return;
+					}
+				}
+				char buf[64 * 1024];
+				auto res = ::read(m_fd, buf, sizeof(buf));
+				if (res <= 0) _exit(1);
+				m_input.append(buf, res);
+			}
+		}
+	};
+
+	struct scenario {
+		const char* name;
+		const char* volume;
+		size_t requests;
+		// Requests written at once before reading their responses
+		size_t pipeline;
+	};
+
+	void run_client(const scenario& s) {
+		client c;
+		auto req = mount_request(s.volume);
+		std::string batch;
+		for (size_t i = 0; i < s.pipeline; i++)
+			batch += req;
+		for (size_t i = 0; i < s.requests; i += s.pipeline) {
+			c.send_all(batch);
+			for (size_t j = 0; j < s.pipeline; j++)
+				c.read_response();
+		}
+	}
+
+	void run(plugin& p, const scenario& s) {
+		auto sends = g_sends.load();
+		auto ctls = g_epoll_ctls.load();
+		auto waits = g_epoll_waits.load();
+		auto pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			run_client(s);
+			_exit(0);
+		}
+		int status = 0;
+		while (waitpid(pid, &status, WNOHANG) == 0)
+			p.run(std::chrono::milliseconds{10});
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s: client failed\n", s.name);
+			exit(1);
+		}
+		auto per_request = [&](uint64_t count) { return static_cast<double>(count) / s.requests; };
+		printf("%-26s %8zu requests   sendmsg %6.3f   epoll_ctl %6.3f   epoll_wait %6.3f  per request\n", s.name, s.requests,
+			   per_request(g_sends - sends), per_request(g_epoll_ctls - ctls), per_request(g_epoll_waits - waits));
+	}
+} // namespace
+
+extern "C" {
+ssize_t sendmsg(int fd, const struct msghdr* msg, int flags) {
+	g_sends++;
+	return syscall(SYS_sendmsg, fd, msg, flags);
+}
+ssize_t send(int fd, const void* buf, size_t len, int flags) {
+	g_sends++;
+	return syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+	g_epoll_ctls++;
+	return static_cast<int>(syscall(SYS_epoll_ctl, epfd, op, fd, event));
+}
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+	g_epoll_waits++;
+	return static_cast<int>(syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, nullptr, _NSIG / 8));
+}
+}
+
+int main() {
+	mkdir("/run/docker", 0755);
+	mkdir("/run/docker/plugins", 0755);
+	unlink(socket_path);
+	plugin p{"dpcpp-write-bench", nullptr, io_backend::epoll};
+	bench_driver drv;
+	p.register_volume(drv);
+
+	const scenario scenarios[] = {
+		{"sequential", "small", 20000, 1},
+		{"pipelined x16", "small", 20000, 16},
+		{"sequential, 64K response", "large", 2000, 1},
+		{"pipelined x4, 64K response", "large", 2000, 4},
+	};
+	for (auto& s : scenarios)
+		run(p, s);
+	unlink(socket_path);
+	return 0;
+}
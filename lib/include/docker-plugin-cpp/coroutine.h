@@ -0,0 +1,334 @@
+#pragma once
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "docker-plugin-cpp/coroutine.h requires C++20 coroutine support"
+#endif
+#include "ipam/api.h"
+#include "network/api.h"
+#include "volume/api.h"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace docker_plugin {
+	/**
+	 * \brief Common part of all promises, links a coroutine to the request it runs for.
+	 */
+	struct request_promise_base {
+		// Token of the request, used to get back onto the event loop
+		const completion_base* request{nullptr};
+	};
+
+	template <typename T>
+	struct task_result {
+		std::optional<T> value{};
+		void return_value(T v) { value.emplace(std::move(v)); }
+		T take() { return std::move(*value); }
+	};
+
+	template <>
+	struct task_result<void> {
+		void return_void() noexcept {}
+		void take() noexcept {}
+	};
+
+	/**
+	 * \brief Lazily started coroutine returning a T.
+	 *
+	 * Starts running once awaited and resumes the awaiting coroutine when done.
+	 * Exceptions are rethrown in the awaiting coroutine.
+	 */
+	template <typename T>
+	class task {
+	public:
+		struct promise_type : request_promise_base, task_result<T> {
+			std::exception_ptr error{};
+			std::coroutine_handle<> continuation{};
+
+			task get_return_object() noexcept { return task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			auto final_suspend() noexcept {
+				struct final_awaiter {
+					bool await_ready() noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+						auto next = h.promise().continuation;
+						return next ? next : std::noop_coroutine();
+					}
+					void await_resume() noexcept {}
+				};
+				return final_awaiter{};
+			}
+			void unhandled_exception() noexcept { error = std::current_exception(); }
+		};
+
+	private:
+		std::coroutine_handle<promise_type> m_handle;
+
+		explicit task(std::coroutine_handle<promise_type> h) noexcept : m_handle{h} {}
+
+	public:
+		task(const task&) = delete;
+		task& operator=(const task&) = delete;
+		task(task&& other) noexcept : m_handle{std::exchange(other.m_handle, nullptr)} {}
+		task& operator=(task&& other) noexcept {
+			std::swap(m_handle, other.m_handle);
+			return *this;
+		}
+		~task() {
+			if (m_handle) m_handle.destroy();
+		}
+
+		bool await_ready() const noexcept { return false; }
+		template <typename TPromise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> parent) noexcept {
+			m_handle.promise().request = parent.promise().request;
+			m_handle.promise().continuation = parent;
+			return m_handle;
+		}
+		T await_resume() {
+			if (m_handle.promise().error) std::rethrow_exception(m_handle.promise().error);
+			return m_handle.promise().take();
+		}
+	};
+
+	/**
+	 * \brief Awaitable for results delivered through a callback, created using async_result().
+	 */
+	template <typename T, typename TFn>
+	class callback_awaiter {
+		TFn m_fn;
+		std::optional<T> m_value{};
+
+	public:
+		explicit callback_awaiter(TFn fn) : m_fn{std::move(fn)} {}
+
+		bool await_ready() const noexcept { return false; }
+		template <typename TPromise>
+		void await_suspend(std::coroutine_handle<TPromise> h) {
+			auto request = h.promise().request;
+			m_fn([this, request, h](T value) {
+				m_value.emplace(std::move(value));
+				request->post([h]() { h.resume(); });
+			});
+		}
+		T await_resume() { return std::move(*m_value); }
+	};
+
+	/**
+	 * \brief Wait for a result delivered through a callback, e.g. by a client library running its own I/O thread.
+	 * \param fn Called with a callback taking a T, which needs to be invoked exactly once, from any thread.
+	 * The awaiting coroutine continues on the event loop. It is never resumed if the plugin
+	 * gets destroyed before the callback was invoked.
+	 */
+	template <typename T, typename TFn>
+	callback_awaiter<T, TFn> async_result(TFn fn) {
+		return callback_awaiter<T, TFn>{std::move(fn)};
+	}
+
+	/**
+	 * \brief Coroutine running a driver task for a request and sending its result.
+	 */
+	struct detached_request {
+		struct promise_type : request_promise_base {
+			template <typename... TArgs>
+			explicit promise_type(const completion_base& res, TArgs&...) noexcept {
+				request = &res;
+			}
+			detached_request get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	template <typename TResponse, typename TFn>
+	detached_request run_request(completion<TResponse> res, TFn fn) {
+		try {
+			auto value = co_await fn();
+			res(value);
+		} catch (const error_response& e) {
+			res.fail(e);
+		} catch (const std::invalid_argument& e) {
+			res.fail({400, e.what()});
+		} catch (const std::exception& e) {
+			res.fail({500, e.what()});
+		}
+	}
+
+	namespace volume {
+		/**
+		 * \brief Volume driver implemented using coroutines.
+		 * The request passed in stays valid until the returned task finished.
+		 */
+		struct coroutine_driver {
+			virtual ~coroutine_driver() = default;
+			virtual task<error_response> create(const create_request& req) = 0;
+			virtual task<list_response> list(const empty_type&) = 0;
+			virtual task<get_response> get(const get_request& req) = 0;
+			virtual task<error_response> remove(const remove_request& req) = 0;
+			virtual task<path_response> path(const path_request& req) = 0;
+			virtual task<mount_response> mount(const mount_request& req) = 0;
+			virtual task<error_response> unmount(const unmount_request& req) = 0;
+			virtual task<capabilities_response> capabilities(const empty_type&) = 0;
+		};
+
+		/**
+		 * \brief Serves a coroutine_driver through the async_driver interface, register it using plugin::register_volume().
+		 */
+		class coroutine_adapter : public async_driver {
+			coroutine_driver& m_driver;
+
+		public:
+			explicit coroutine_adapter(coroutine_driver& drv) noexcept : m_driver{drv} {}
+
+			void create(const create_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.create(req); });
+			}
+			void list(const empty_type& req, completion<list_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.list(req); });
+			}
+			void get(const get_request& req, completion<get_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.get(req); });
+			}
+			void remove(const remove_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.remove(req); });
+			}
+			void path(const path_request& req, completion<path_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.path(req); });
+			}
+			void mount(const mount_request& req, completion<mount_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.mount(req); });
+			}
+			void unmount(const unmount_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.unmount(req); });
+			}
+			void capabilities(const empty_type& req, completion<capabilities_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.capabilities(req); });
+			}
+		};
+	} // namespace volume
+
+	namespace network {
+		/**
+		 * \brief Network driver implemented using coroutines.
+		 * The request passed in stays valid until the returned task finished.
+		 */
+		struct coroutine_driver {
+			virtual ~coroutine_driver() = default;
+			virtual task<capabilities_response> capabilities(const empty_type&) = 0;
+			virtual task<error_response> create_network(const create_network_request& req) = 0;
+			virtual task<allocate_network_response> allocate_network(const allocate_network_request& req) = 0;
+			virtual task<error_response> delete_network(const delete_network_request& req) = 0;
+			virtual task<error_response> free_network(const free_network_request& req) = 0;
+			virtual task<create_endpoint_response> create_endpoint(const create_endpoint_request& req) = 0;
+			virtual task<error_response> delete_endpoint(const delete_endpoint_request& req) = 0;
+			virtual task<info_response> endpoint_info(const info_request& req) = 0;
+			virtual task<join_response> join(const join_request& req) = 0;
+			virtual task<error_response> leave(const leave_request& req) = 0;
+			virtual task<error_response> discover_new(const discovery_notification& req) = 0;
+			virtual task<error_response> discover_delete(const discovery_notification& req) = 0;
+			virtual task<error_response> program_external_connectivity(const program_external_connectivity_request& req) = 0;
+			virtual task<error_response> revoke_external_connectivity(const revoke_external_connectivity_request& req) = 0;
+		};
+
+		/**
+		 * \brief Serves a coroutine_driver through the async_driver interface, register it using plugin::register_network().
+		 */
+		class coroutine_adapter : public async_driver {
+			coroutine_driver& m_driver;
+
+		public:
+			explicit coroutine_adapter(coroutine_driver& drv) noexcept : m_driver{drv} {}
+
+			void capabilities(const empty_type& req, completion<capabilities_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.capabilities(req); });
+			}
+			void create_network(const create_network_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.create_network(req); });
+			}
+			void allocate_network(const allocate_network_request& req, completion<allocate_network_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.allocate_network(req); });
+			}
+			void delete_network(const delete_network_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.delete_network(req); });
+			}
+			void free_network(const free_network_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.free_network(req); });
+			}
+			void create_endpoint(const create_endpoint_request& req, completion<create_endpoint_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.create_endpoint(req); });
+			}
+			void delete_endpoint(const delete_endpoint_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.delete_endpoint(req); });
+			}
+			void endpoint_info(const info_request& req, completion<info_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.endpoint_info(req); });
+			}
+			void join(const join_request& req, completion<join_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.join(req); });
+			}
+			void leave(const leave_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.leave(req); });
+			}
+			void discover_new(const discovery_notification& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.discover_new(req); });
+			}
+			void discover_delete(const discovery_notification& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.discover_delete(req); });
+			}
+			void program_external_connectivity(const program_external_connectivity_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.program_external_connectivity(req); });
+			}
+			void revoke_external_connectivity(const revoke_external_connectivity_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.revoke_external_connectivity(req); });
+			}
+		};
+	} // namespace network
+
+	namespace ipam {
+		/**
+		 * \brief Ipam driver implemented using coroutines.
+		 * The request passed in stays valid until the returned task finished.
+		 */
+		struct coroutine_driver {
+			virtual ~coroutine_driver() = default;
+			virtual task<capabilities_response> capabilities(const empty_type&) = 0;
+			virtual task<address_spaces_response> default_address_spaces(const empty_type&) = 0;
+			virtual task<request_pool_response> request_pool(const request_pool_request& req) = 0;
+			virtual task<error_response> release_pool(const release_pool_request& req) = 0;
+			virtual task<request_address_response> request_address(const request_address_request& req) = 0;
+			virtual task<error_response> release_address(const release_address_request& req) = 0;
+		};
+
+		/**
+		 * \brief Serves a coroutine_driver through the async_driver interface, register it using plugin::register_ipam().
+		 */
+		class coroutine_adapter : public async_driver {
+			coroutine_driver& m_driver;
+
+		public:
+			explicit coroutine_adapter(coroutine_driver& drv) noexcept : m_driver{drv} {}
+
+			void capabilities(const empty_type& req, completion<capabilities_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.capabilities(req); });
+			}
+			void default_address_spaces(const empty_type& req, completion<address_spaces_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.default_address_spaces(req); });
+			}
+			void request_pool(const request_pool_request& req, completion<request_pool_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.request_pool(req); });
+			}
+			void release_pool(const release_pool_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.release_pool(req); });
+			}
+			void request_address(const request_address_request& req, completion<request_address_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.request_address(req); });
+			}
+			void release_address(const release_address_request& req, completion<error_response> res) override {
+				run_request(std::move(res), [this, req]() { return m_driver.release_address(req); });
+			}
+		};
+	} // namespace ipam
+} // namespace docker_plugin
@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace docker_plugin {
+	/**
+	 * \brief Identifier of a docker network, endpoint or address pool.
+	 *
+	 * Docker generates these as 64 lower case hex digits, which are stored as the
+	 * 32 bytes they encode. Anything else, e.g. the pool ids of the default ipam
+	 * driver, is kept as text and formatted back exactly as it was given. Text of
+	 * up to inline_capacity characters lives inline, longer text on the heap, where
+	 * its buffer is kept for reuse. Hashing and comparing never allocate.
+	 */
+	class docker_id {
+	public:
+		/// Number of digits of an id stored as bytes
+		static constexpr size_t hex_length = 64;
+		/// Longest text kept inline
+		static constexpr size_t inline_capacity = 64;
+
+	private:
+		// 32 bytes for hex ids, the text otherwise unless it is longer than inline_capacity
+		uint8_t m_data[inline_capacity];
+		// Text longer than inline_capacity
+		char* m_long;
+		size_t m_long_capacity;
+		// Bytes used in m_data or m_long
+		size_t m_size;
+		bool m_hex;
+
+		// Three way comparison of the text forms
+		static int compare(const docker_id& lhs, const docker_id& rhs) noexcept;
+
+	public:
+		docker_id() noexcept
+			: m_data{}, m_long{nullptr}, m_long_capacity{0}, m_size{0}, m_hex{false} {}
+		docker_id(const std::string& str)
+			: docker_id{} {
+			assign(str.data(), str.size());
+		}
+		docker_id(const char* str)
+			: docker_id{} {
+			assign(str, strlen(str));
+		}
+		docker_id(const docker_id& other)
+			: docker_id{} {
+			*this = other;
+		}
+		docker_id(docker_id&& other) noexcept
+			: docker_id{} {
+			*this = std::move(other);
+		}
+		~docker_id() { delete[] m_long; }
+		docker_id& operator=(const docker_id& other);
+		docker_id& operator=(docker_id&& other) noexcept;
+
+		/**
+		 * \brief Set the id from its text form.
+		 */
+		void assign(const char* data, size_t len);
+		void clear() noexcept {
+			m_size = 0;
+			m_hex = false;
+		}
+
+		bool empty() const noexcept { return m_size == 0; }
+		/**
+		 * \brief Whether the id was 64 hex digits and bytes() is valid.
+		 */
+		bool is_hex() const noexcept { return m_hex; }
+		const uint8_t* bytes() const noexcept { return m_data; }
+		/**
+		 * \brief The text of an id that is not hex, see is_hex(), which is size() characters long.
+		 */
+		const char* text() const noexcept { return m_size > inline_capacity ? m_long : reinterpret_cast<const char*>(m_data); }
+		/**
+		 * \brief Number of characters of the text form.
+		 */
+		size_t size() const noexcept { return m_hex ? hex_length : m_size; }
+
+		/**
+		 * \brief Write the text form of the id, out needs room for size() characters.
+		 * \return Number of characters written
+		 */
+		size_t format(char* out) const noexcept;
+		std::string str() const;
+
+		size_t hash() const noexcept {
+			if (m_hex) {
+				// Random or sha256 based, any eight bytes are as good as a full hash
+				uint64_t res;
+				memcpy(&res, m_data, sizeof(res));
+				return static_cast<size_t>(res);
+			}
+			// FNV-1a
+			uint64_t res = 14695981039346656037u;
+			auto str = text();
+			for (size_t i = 0; i < m_size; i++)
+				res = (res ^ static_cast<uint8_t>(str[i])) * 1099511628211u;
+			return static_cast<size_t>(res);
+		}
+
+		friend bool operator==(const docker_id& lhs, const docker_id& rhs) noexcept {
+			// Hex bytes are inline as well, text() points at them
+			return lhs.m_hex == rhs.m_hex && lhs.m_size == rhs.m_size && memcmp(lhs.text(), rhs.text(), lhs.m_size) == 0;
+		}
+		friend bool operator!=(const docker_id& lhs, const docker_id& rhs) noexcept { return !(lhs == rhs); }
+		/**
+		 * \brief Same order as comparing the text of both ids.
+		 */
+		friend bool operator<(const docker_id& lhs, const docker_id& rhs) noexcept {
+			if (lhs.m_hex && rhs.m_hex) return memcmp(lhs.m_data, rhs.m_data, lhs.m_size) < 0;
+			return compare(lhs, rhs) < 0;
+		}
+	};
+} // namespace docker_plugin
+
+namespace std {
+	template <>
+	struct hash<docker_plugin::docker_id> {
+		size_t operator()(const docker_plugin::docker_id& id) const noexcept { return id.hash(); }
+	};
+} // namespace std
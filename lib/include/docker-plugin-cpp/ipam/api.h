@@ -1,6 +1,7 @@
 #pragma once
+#include "../docker_id.h"
 #include "../plugin.h"
-#include <unordered_map>
+#include "../small_map.h"
 
 namespace docker_plugin {
 	namespace ipam {
@@ -17,33 +18,33 @@ namespace docker_plugin {
 			std::string address_space{};
 			std::string pool{};
 			std::string sub_pool{};
-			std::unordered_map<std::string, std::string> options{};
+			string_map options{};
 			bool ipv6{};
 		};
 
 		struct request_pool_response {
-			std::string pool_id{};
+			docker_id pool_id{};
 			std::string pool{};
-			std::unordered_map<std::string, std::string> data{};
+			string_map data{};
 		};
 
 		struct release_pool_request {
-			std::string pool_id{};
+			docker_id pool_id{};
 		};
 
 		struct request_address_request {
-			std::string pool_id{};
+			docker_id pool_id{};
 			std::string address{};
-			std::unordered_map<std::string, std::string> options{};
+			string_map options{};
 		};
 
 		struct request_address_response {
 			std::string address{};
-			std::unordered_map<std::string, std::string> data{};
+			string_map data{};
 		};
 
 		struct release_address_request {
-			std::string pool_id{};
+			docker_id pool_id{};
 			std::string address{};
 		};
 
@@ -56,5 +57,20 @@ namespace docker_plugin {
 			virtual request_address_response request_address(const request_address_request& req) = 0;
 			virtual error_response release_address(const release_address_request& req) = 0;
 		};
+
+		/**
+		 * \brief Ipam driver answering requests asynchronously.
+		 * Every call receives a completion token, the response is sent once it was invoked.
+		 * The request is only valid during the call, copy what is needed later.
+		 */
+		struct async_driver {
+			virtual ~async_driver() = default;
+			virtual void capabilities(const empty_type&, completion<capabilities_response> res) = 0;
+			virtual void default_address_spaces(const empty_type&, completion<address_spaces_response> res) = 0;
+			virtual void request_pool(const request_pool_request& req, completion<request_pool_response> res) = 0;
+			virtual void release_pool(const release_pool_request& req, completion<error_response> res) = 0;
+			virtual void request_address(const request_address_request& req, completion<request_address_response> res) = 0;
+			virtual void release_address(const release_address_request& req, completion<error_response> res) = 0;
+		};
 	} // namespace ipam
 } // namespace docker_plugin
\ No newline at end of file
@@ -32,4 +32,31 @@ namespace docker_plugin {
 		bool should_log(level l) const noexcept override;
 		void log(level l, const std::string& msg) const noexcept override;
 	};
+
+	/**
+	 * \brief Logger passing messages on to another logger from a background thread.
+	 *
+	 * log() copies the message into a lock free ring buffer and never blocks, so formatting
+	 * and writing happens off the event loop. Messages logged while the ring is full are
+	 * dropped and counted. Remaining messages are flushed on destruction.
+	 */
+	class async_logger : public logger {
+		struct state;
+		std::unique_ptr<state> m_state;
+
+	public:
+		/**
+		 * \param sink Logger receiving the messages, needs to outlive this instance.
+		 * \param capacity Number of messages the ring can hold, rounded up to a power of two.
+		 */
+		explicit async_logger(const logger& sink, size_t capacity = 4096);
+		~async_logger();
+
+		bool should_log(level l) const noexcept override;
+		void log(level l, const std::string& msg) const noexcept override;
+		/**
+		 * \brief Number of messages dropped because the ring was full.
+		 */
+		size_t dropped() const noexcept;
+	};
 } // namespace docker_plugin
\ No newline at end of file
@@ -1,8 +1,9 @@
 #pragma once
+#include "../docker_id.h"
 #include "../plugin.h"
+#include "../small_map.h"
 #include <chrono>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace docker_plugin {
@@ -16,33 +17,33 @@ namespace docker_plugin {
 			std::string address_space{};
 			std::string pool{};
 			std::string gateway{};
-			std::unordered_map<std::string, std::string> aux_addresses{};
+			string_map aux_addresses{};
 		};
 
 		struct create_network_request {
-			std::string network_id{};
-			std::unordered_map<std::string, std::string> options{};
+			docker_id network_id{};
+			string_map options{};
 			std::vector<ipam_data> ipv4_data{};
 			std::vector<ipam_data> ipv6_data{};
 		};
 
 		struct allocate_network_request {
-			std::string network_id{};
-			std::unordered_map<std::string, std::string> options{};
+			docker_id network_id{};
+			string_map options{};
 			std::vector<ipam_data> ipv4_data{};
 			std::vector<ipam_data> ipv6_data{};
 		};
 
 		struct allocate_network_response {
-			std::unordered_map<std::string, std::string> options{};
+			string_map options{};
 		};
 
 		struct delete_network_request {
-			std::string network_id{};
+			docker_id network_id{};
 		};
 
 		struct free_network_request {
-			std::string network_id{};
+			docker_id network_id{};
 		};
 
 		struct endpoint_interface {
@@ -54,10 +55,10 @@ namespace docker_plugin {
 		};
 
 		struct create_endpoint_request {
-			std::string network_id{};
-			std::string endpoint_id{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
 			endpoint_interface interface {};
-			std::unordered_map<std::string, std::string> options{};
+			string_map options{};
 		};
 
 		struct create_endpoint_response {
@@ -65,24 +66,24 @@ namespace docker_plugin {
 		};
 
 		struct delete_endpoint_request {
-			std::string network_id{};
-			std::string endpoint_id{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
 		};
 
 		struct info_request {
-			std::string network_id{};
-			std::string endpoint_id{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
 		};
 
 		struct info_response {
-			std::unordered_map<std::string, std::string> value{};
+			string_map value{};
 		};
 
 		struct join_request {
-			std::string network_id{};
-			std::string endpoint_id{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
 			std::string sandbox_key{};
-			std::unordered_map<std::string, std::string> options{};
+			string_map options{};
 		};
 
 		struct static_route {
@@ -103,8 +104,8 @@ namespace docker_plugin {
 		};
 
 		struct leave_request {
-			std::string network_id{};
-			std::string endpoint_id{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
 		};
 
 		struct discovery_notification {
@@ -119,14 +120,14 @@ namespace docker_plugin {
 		};
 
 		struct program_external_connectivity_request {
-			std::string network_id{};
-			std::string endpoint_id{};
-			std::unordered_map<std::string, std::string> options{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
+			string_map options{};
 		};
 
 		struct revoke_external_connectivity_request {
-			std::string network_id{};
-			std::string endpoint_id{};
+			docker_id network_id{};
+			docker_id endpoint_id{};
 		};
 
 		struct driver {
@@ -146,5 +147,28 @@ namespace docker_plugin {
 			virtual error_response program_external_connectivity(const program_external_connectivity_request& req) = 0;
 			virtual error_response revoke_external_connectivity(const revoke_external_connectivity_request& req) = 0;
 		};
+
+		/**
+		 * \brief Network driver answering requests asynchronously.
+		 * Every call receives a completion token, the response is sent once it was invoked.
+		 * The request is only valid during the call, copy what is needed later.
+		 */
+		struct async_driver {
+			virtual ~async_driver() = default;
+			virtual void capabilities(const empty_type&, completion<capabilities_response> res) = 0;
+			virtual void create_network(const create_network_request& req, completion<error_response> res) = 0;
+			virtual void allocate_network(const allocate_network_request& req, completion<allocate_network_response> res) = 0;
+			virtual void delete_network(const delete_network_request& req, completion<error_response> res) = 0;
+			virtual void free_network(const free_network_request& req, completion<error_response> res) = 0;
+			virtual void create_endpoint(const create_endpoint_request& req, completion<create_endpoint_response> res) = 0;
+			virtual void delete_endpoint(const delete_endpoint_request& req, completion<error_response> res) = 0;
+			virtual void endpoint_info(const info_request& req, completion<info_response> res) = 0;
+			virtual void join(const join_request& req, completion<join_response> res) = 0;
+			virtual void leave(const leave_request& req, completion<error_response> res) = 0;
+			virtual void discover_new(const discovery_notification& req, completion<error_response> res) = 0;
+			virtual void discover_delete(const discovery_notification& req, completion<error_response> res) = 0;
+			virtual void program_external_connectivity(const program_external_connectivity_request& req, completion<error_response> res) = 0;
+			virtual void revoke_external_connectivity(const revoke_external_connectivity_request& req, completion<error_response> res) = 0;
+		};
 	} // namespace network
 } // namespace docker_plugin
\ No newline at end of file
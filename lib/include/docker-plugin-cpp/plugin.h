@@ -1,30 +1,79 @@
 #pragma once
 #include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 
 namespace docker_plugin {
 	// Forward declarations
 	namespace volume {
 		struct driver;
-	}
+		struct async_driver;
+	} // namespace volume
 	namespace network {
 		struct driver;
-	}
+		struct async_driver;
+	} // namespace network
 	namespace ipam {
 		struct driver;
-	}
+		struct async_driver;
+	} // namespace ipam
 	class uds_server;
+	class executor;
+	class trace_log;
+	class timer;
+	class plugin_metrics;
 	class plugin_http_connection;
+	class metrics_http_connection;
 	class logger;
 
+	/**
+	 * \brief Mechanism used to wait for socket events
+	 */
+	enum class io_backend {
+		/// Portable select() loop, limited to FD_SETSIZE file descriptors
+		select,
+		/// Linux epoll, descriptors are registered once and only ready connections are visited
+		epoll,
+		/// Linux io_uring using multishot accept/recv and batched sends, falls back to epoll if unsupported
+		io_uring
+	};
+
+	/**
+	 * \brief Counters of the work turned away by admission control
+	 */
+	struct load_shedding_stats {
+		/// Connections closed right away because of the connection limit
+		uint64_t rejected_connections{};
+		/// Requests answered with 429 because the pending queue was full
+		uint64_t rejected_requests{};
+		/// Requests that had to wait for a free slot
+		uint64_t queued_requests{};
+		/// Requests currently handed to a driver
+		size_t inflight_requests{};
+		/// Requests currently waiting for a slot
+		size_t pending_requests{};
+	};
+
 	/**
 	 * \brief Main plugin class
 	 *
 	 * This creates a uds socket in dockers plugin folder, hosts a http 1.1 server on it and handles serialization and request handling.
 	 */
 	class plugin {
+	public:
+		/**
+		 * \brief Handler for a custom endpoint.
+		 * Receives the raw request body and returns the response body. Throwing an
+		 * error_response sets the http status and sends the error as json to docker.
+		 */
+		using endpoint_handler = std::function<std::string(const std::string& body)>;
+
+	private:
 		plugin(const plugin&) = delete;
 		plugin(plugin&&) = delete;
 		plugin& operator=(const plugin&) = delete;
@@ -32,19 +81,45 @@ namespace docker_plugin {
 
 		logger* m_logger;
 		std::unique_ptr<uds_server> m_server;
+		std::unique_ptr<executor> m_executor;
+		std::unique_ptr<trace_log> m_trace;
+		std::unique_ptr<plugin_metrics> m_metrics;
 		volume::driver* m_volume_driver;
 		network::driver* m_network_driver;
 		ipam::driver* m_ipam_driver;
+		volume::async_driver* m_volume_async;
+		network::async_driver* m_network_async;
+		ipam::async_driver* m_ipam_async;
+		std::unordered_map<std::string, endpoint_handler> m_endpoints;
+		// Serialized responses by path, empty until the first successful request
+		std::unordered_map<std::string, std::string> m_response_cache;
+		std::unordered_map<std::string, std::chrono::milliseconds> m_deadlines;
+		std::unordered_map<uint64_t, std::unique_ptr<timer>> m_timers;
+		uint64_t m_next_timer;
+		// Admission control, no accounting while m_max_inflight is zero
+		size_t m_max_inflight;
+		size_t m_max_pending;
+		size_t m_inflight;
+		std::deque<plugin_http_connection*> m_pending;
+		// Prepared response for requests that don't fit into the pending queue
+		std::string m_reject_response;
+		uint64_t m_rejected_requests;
+		uint64_t m_queued_requests;
 
 		friend class plugin_http_connection;
+		friend class metrics_http_connection;
+
+		// Drop the cached Plugin.Activate response and those of every path starting with prefix
+		void invalidate_driver(const char* prefix) noexcept;
 
 	public:
 		/**
 		 * \brief Create a new plugin with the specified name
 		 * \param driver_name The name of the plugin as to be used by docker.
 		 * \param log Logger implementation to use or nullptr for no logging.
+		 * \param backend Event loop implementation used for socket I/O.
 		 */
-		plugin(const std::string& driver_name, logger* log = nullptr);
+		plugin(const std::string& driver_name, logger* log = nullptr, io_backend backend = io_backend::select);
 		~plugin();
 
 		/**
@@ -53,7 +128,23 @@ namespace docker_plugin {
 		 * This causes the plugin to announce support for volume handling in
 		 * Plugin.Activate and forward all plugin related calls to the handler.
 		 */
-		void register_volume(volume::driver& drv) noexcept { m_volume_driver = &drv; }
+		void register_volume(volume::driver& drv) noexcept {
+			m_volume_driver = &drv;
+			m_volume_async = nullptr;
+			invalidate_driver("/VolumeDriver.");
+		}
+
+		/**
+		 * \brief Register a volume driver answering requests asynchronously.
+		 * \param drv Reference to the driver implementation. Needs to stay valid as long as run() is active.
+		 * Replaces a driver registered using the synchronous interface. Calls receive a completion
+		 * token, the response is sent once it was invoked, which can happen on any thread.
+		 */
+		void register_volume(volume::async_driver& drv) noexcept {
+			m_volume_driver = nullptr;
+			m_volume_async = &drv;
+			invalidate_driver("/VolumeDriver.");
+		}
 
 		/**
 		 * \brief Register a network driver for this plugin.
@@ -61,7 +152,23 @@ namespace docker_plugin {
 		 * This causes the plugin to announce support for network handling in
 		 * Plugin.Activate and forward all plugin related calls to the handler.
 		 */
-		void register_network(network::driver& drv) noexcept { m_network_driver = &drv; }
+		void register_network(network::driver& drv) noexcept {
+			m_network_driver = &drv;
+			m_network_async = nullptr;
+			invalidate_driver("/NetworkDriver.");
+		}
+
+		/**
+		 * \brief Register a network driver answering requests asynchronously.
+		 * \param drv Reference to the driver implementation. Needs to stay valid as long as run() is active.
+		 * Replaces a driver registered using the synchronous interface. Calls receive a completion
+		 * token, the response is sent once it was invoked, which can happen on any thread.
+		 */
+		void register_network(network::async_driver& drv) noexcept {
+			m_network_driver = nullptr;
+			m_network_async = &drv;
+			invalidate_driver("/NetworkDriver.");
+		}
 
 		/**
 		 * \brief Register a ipam driver for this plugin.
@@ -69,11 +176,157 @@ namespace docker_plugin {
 		 * This causes the plugin to announce support for ipam handling in
 		 * Plugin.Activate and forward all plugin related calls to the handler.
 		 */
-		void register_ipam(ipam::driver& drv) noexcept { m_ipam_driver = &drv; }
+		void register_ipam(ipam::driver& drv) noexcept {
+			m_ipam_driver = &drv;
+			m_ipam_async = nullptr;
+			invalidate_driver("/IpamDriver.");
+		}
+
+		/**
+		 * \brief Register a ipam driver answering requests asynchronously.
+		 * \param drv Reference to the driver implementation. Needs to stay valid as long as run() is active.
+		 * Replaces a driver registered using the synchronous interface. Calls receive a completion
+		 * token, the response is sent once it was invoked, which can happen on any thread.
+		 */
+		void register_ipam(ipam::async_driver& drv) noexcept {
+			m_ipam_driver = nullptr;
+			m_ipam_async = &drv;
+			invalidate_driver("/IpamDriver.");
+		}
+
+		/**
+		 * \brief Register a handler for an additional endpoint.
+		 * \param path Full request path, e.g. "/Authz.AuthZReq".
+		 * \param handler Handler invoked for every request to path. Replaces a previously registered handler.
+		 * Custom endpoints take precedence over the built in ones, which allows
+		 * overriding e.g. Plugin.Activate to announce additional implementations.
+		 */
+		void register_endpoint(const std::string& path, endpoint_handler handler) {
+			m_endpoints[path] = std::move(handler);
+			invalidate_response(path);
+		}
+
+		/**
+		 * \brief Declare the response of an endpoint immutable.
+		 * \param path Request path, e.g. "/VolumeDriver.Capabilities".
+		 * The first successful response is kept fully serialized and sent as is for all
+		 * following requests to path, without parsing the request or calling the driver.
+		 * Only use this for endpoints whose response does not depend on the request.
+		 * Plugin.Activate is cached by default.
+		 */
+		void cache_response(const std::string& path) { m_response_cache.emplace(path, std::string{}); }
+
+		/**
+		 * \brief Drop the cached response for path, e.g. after the capabilities of a driver changed.
+		 * The endpoint stays cached, the next request creates a new response.
+		 */
+		void invalidate_response(const std::string& path) noexcept {
+			auto it = m_response_cache.find(path);
+			if (it != m_response_cache.end()) it->second.clear();
+		}
+
+		/**
+		 * \brief Stop caching the response of path.
+		 */
+		void uncache_response(const std::string& path) noexcept { m_response_cache.erase(path); }
+
+		/**
+		 * \brief Limit the time a driver may take to answer requests to path.
+		 * \param path Request path, e.g. "/VolumeDriver.Mount".
+		 * \param timeout Time after which the request is answered with status 504, 0 removes the limit.
+		 * Applies to asynchronous drivers and calls made on worker threads. Once the deadline passed or the
+		 * client disconnected the request is cancelled: queued calls are skipped, completion tokens report
+		 * cancelled() and whatever they are completed with is dropped without being serialized.
+		 */
+		void set_deadline(const std::string& path, std::chrono::milliseconds timeout) {
+			if (timeout.count() > 0)
+				m_deadlines[path] = timeout;
+			else
+				m_deadlines.erase(path);
+		}
+
+		/**
+		 * \brief Limit the load the plugin accepts, zero disables a limit.
+		 * \param max_connections Connections over this limit are answered with 503 and closed without reading the request.
+		 * \param max_inflight Number of requests handed to drivers at the same time. A request counts until the driver
+		 * call returned or dropped its completion token, even if the client got a 504 or disconnected before.
+		 * \param max_pending Requests waiting for one of the max_inflight slots, further ones are answered with 429.
+		 * \param retry_after Value of the Retry-After header sent with 503 and 429.
+		 * Rejected requests never reach the driver. See get_shedding_stats() for how much was turned away.
+		 */
+		void set_admission_limits(size_t max_connections, size_t max_inflight, size_t max_pending, std::chrono::seconds retry_after = std::chrono::seconds{1});
+
+		/**
+		 * \brief Get the counters of admission control.
+		 */
+		load_shedding_stats get_shedding_stats() const noexcept;
+
+		/**
+		 * \brief Close connections that stop making progress.
+		 * \param idle Time without input after which a connection that has no request in progress is closed.
+		 * \param header Time a client may take to send the headers of a request.
+		 * \param body Time a client may take to send the body of a request after its headers.
+		 * Requests exceeding header or body are answered with 408 and the connection is closed.
+		 * Zero disables a limit, the defaults are 60s, 10s and 30s.
+		 */
+		void set_timeouts(std::chrono::milliseconds idle, std::chrono::milliseconds header, std::chrono::milliseconds body) noexcept;
+
+		/**
+		 * \brief Call fn from within run() once delay passed.
+		 * \return Id to cancel the timer with.
+		 * Must be called from the thread calling run(), e.g. from a driver call or a function posted using a completion token.
+		 */
+		uint64_t start_timer(std::chrono::milliseconds delay, std::function<void()> fn);
+
+		/**
+		 * \brief Cancel a timer created using start_timer(). Ids of timers that already fired are ignored.
+		 */
+		void cancel_timer(uint64_t id) noexcept;
+
+		/**
+		 * \brief Configure per connection output buffering.
+		 * \param low Queued bytes at which reading from a paused connection resumes.
+		 * \param high Queued bytes at which the plugin stops reading further requests from a connection.
+		 * Responses are never blocking, whatever the client does not read right away is queued.
+		 * A client that does not keep up only stalls its own connection.
+		 */
+		void set_write_watermarks(size_t low, size_t high) noexcept;
+
+		/**
+		 * \brief Record every request in a memory mapped ring file.
+		 * \param path Trace file, created if missing. A file written with the same number of records is continued.
+		 * \param records Number of records kept, older ones get overwritten.
+		 * Records are fixed size binary structs as described in trace.h, the trace_decode tool converts
+		 * them to json lines. Throws std::system_error if the file can not be mapped.
+		 */
+		void enable_trace(const std::string& path, size_t records = 65536);
+
+		/**
+		 * \brief Stop recording requests.
+		 */
+		void disable_trace() noexcept;
+
+		/**
+		 * \brief Collect request statistics and serve them on an additional uds socket.
+		 * \param path Socket to create, answers GET /metrics in prometheus text format.
+		 * Exports latency histograms per endpoint for parsing, the driver call and writing the
+		 * response, as well as counters for connections, bytes and response status codes.
+		 * Throws std::system_error if the socket can not be bound.
+		 */
+		void enable_metrics(const std::string& path);
+
+		/**
+		 * \brief Call synchronous drivers from a pool of worker threads.
+		 * \param count Number of threads, 0 calls the drivers from within run() again.
+		 * Calls concerning the same volume, network, endpoint or address pool are made one
+		 * after another in the order they arrived, all others run in parallel. The drivers
+		 * need to be thread safe. Must not be called while run() is active.
+		 */
+		void set_worker_threads(size_t count);
 
 		/**
 		 * \brief Run the mainloop with the specified timeout.
-		 * \param timeout Maximum time to wait for events
+		 * \param timeout Maximum time to wait for events, returns earlier once a timer is due
 		 * This needs to be called in a loop, stopping to call it
 		 * will cause all I/O to halt. Handlercallbacks will be called
 		 * from within this function.
@@ -81,6 +334,21 @@ namespace docker_plugin {
 		 */
 		int run(std::chrono::milliseconds timeout = std::chrono::milliseconds{1000});
 
+		/**
+		 * \brief Get a file descriptor to embed the plugin into an existing event loop instead of calling run().
+		 * The fd becomes readable whenever process_ready() has work to do, including completed asynchronous
+		 * calls and due timers. Watch it level triggered. Requires the epoll or io_uring backend.
+		 * \return The fd or -1 if the backend does not support it.
+		 */
+		int get_fd();
+
+		/**
+		 * \brief Handle everything that is ready without blocking.
+		 * Call this once the fd returned by get_fd() is readable. Handler callbacks are called from within this function.
+		 * \return Returns 0 on success or the errno if an error occurred.
+		 */
+		int process_ready();
+
 		/**
 		 * \brief Get the logger used by this plugin
 		 */
@@ -100,4 +368,60 @@ namespace docker_plugin {
 		int status{};
 		std::string error{};
 	};
+
+	// ============= Asynchronous completion =============
+
+	class async_response;
+
+	class completion_base {
+	protected:
+		std::shared_ptr<async_response> m_response;
+
+		explicit completion_base(std::shared_ptr<async_response> res) : m_response{std::move(res)} {}
+		void complete(int status, std::string body) const;
+
+	public:
+		/**
+		 * \brief Answer the request with an error, using error.status as http status.
+		 */
+		void fail(const error_response& error) const;
+		/**
+		 * \brief Check if the request passed its deadline or the client went away.
+		 * Thread safe. Long running calls should check this and give up early.
+		 */
+		bool cancelled() const noexcept;
+		/**
+		 * \brief Call fn on the thread running the event loop.
+		 * Thread safe. fn is called even if the client went away, unless the plugin was destroyed.
+		 */
+		void post(std::function<void()> fn) const;
+	};
+
+	/**
+	 * \brief Token passed to asynchronous driver calls to send their result.
+	 *
+	 * Can be copied and completed from any thread, only the first completion is sent.
+	 * The response is serialized by the completing thread and written by the event loop,
+	 * completing while still inside the driver call sends it right away. A request whose
+	 * tokens are all destroyed without completing it is answered with an error.
+	 */
+	template <typename T>
+	class completion : public completion_base {
+	public:
+		using serializer = std::string (*)(const T&);
+
+		completion(std::shared_ptr<async_response> res, serializer fn)
+			: completion_base{std::move(res)}, m_serialize{fn} {}
+
+		/**
+		 * \brief Answer the request with value.
+		 */
+		void operator()(const T& value) const {
+			// Nobody is waiting for it, skip serializing
+			complete(200, cancelled() ? std::string{} : m_serialize(value));
+		}
+
+	private:
+		serializer m_serialize;
+	};
 } // namespace docker_plugin
\ No newline at end of file
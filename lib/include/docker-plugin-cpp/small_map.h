@@ -0,0 +1,260 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace docker_plugin {
+	/**
+	 * \brief Map kept as a sorted array, the first N entries are stored inline.
+	 *
+	 * Docker sends options and labels with a handful of entries, for those no memory
+	 * is allocated besides the keys and values themselves. Lookups are a binary search,
+	 * inserting and erasing move the entries behind the position, entries added in key
+	 * order are appended right away. Iteration is in key order. Keys must not be modified
+	 * through iterators.
+	 *
+	 * Converts from and to std::unordered_map, so code written against the previous
+	 * api types keeps compiling.
+	 */
+	template <typename TKey, typename TValue, size_t N = 4>
+	class small_map {
+		static_assert(N > 0, "small_map needs inline storage");
+
+	public:
+		using key_type = TKey;
+		using mapped_type = TValue;
+		using value_type = std::pair<TKey, TValue>;
+		using size_type = size_t;
+		using iterator = value_type*;
+		using const_iterator = const value_type*;
+
+	private:
+		value_type* m_data;
+		size_t m_size;
+		size_t m_capacity;
+		alignas(value_type) unsigned char m_inline[N * sizeof(value_type)];
+
+		value_type* inline_data() noexcept { return reinterpret_cast<value_type*>(m_inline); }
+		bool is_inline() const noexcept { return m_data == reinterpret_cast<const value_type*>(m_inline); }
+
+		void deallocate() noexcept {
+			if (!is_inline()) ::operator delete(m_data);
+		}
+
+		// Move everything to a heap array with room for capacity entries
+		void grow(size_t capacity) {
+			auto data = static_cast<value_type*>(::operator new(capacity * sizeof(value_type)));
+			for (size_t i = 0; i < m_size; i++) {
+				new (data + i) value_type(std::move(m_data[i]));
+				m_data[i].~value_type();
+			}
+			deallocate();
+			m_data = data;
+			m_capacity = capacity;
+		}
+
+		// Where key is or would be inserted, keys arriving in order are appended without a search
+		template <typename K>
+		iterator position(const K& key) {
+			if (m_size == 0 || m_data[m_size - 1].first < key) return end();
+			return lower_bound(key);
+		}
+
+		iterator insert_at(iterator pos, value_type&& val) {
+			size_t idx = pos - m_data;
+			if (m_size == m_capacity) grow(m_capacity * 2);
+			if (idx == m_size) {
+				new (m_data + m_size) value_type(std::move(val));
+			} else {
+				new (m_data + m_size) value_type(std::move(m_data[m_size - 1]));
+				std::move_backward(m_data + idx, m_data + m_size - 1, m_data + m_size);
+				m_data[idx] = std::move(val);
+			}
+			m_size++;
+			return m_data + idx;
+		}
+
+		// Take over the entries of other, which is left empty
+		void steal(small_map& other) noexcept {
+			if (other.is_inline()) {
+				for (size_t i = 0; i < other.m_size; i++)
+					new (m_data + i) value_type(std::move(other.m_data[i]));
+				m_size = other.m_size;
+				other.clear();
+			} else {
+				m_data = other.m_data;
+				m_size = other.m_size;
+				m_capacity = other.m_capacity;
+				other.m_data = other.inline_data();
+				other.m_size = 0;
+				other.m_capacity = N;
+			}
+		}
+
+	public:
+		small_map() noexcept
+			: m_data{inline_data()}, m_size{0}, m_capacity{N} {}
+		small_map(std::initializer_list<value_type> init)
+			: small_map{} {
+			for (auto& e : init)
+				insert_or_assign(e.first, e.second);
+		}
+		small_map(const std::unordered_map<TKey, TValue>& other)
+			: small_map{} {
+			reserve(other.size());
+			for (auto& e : other)
+				emplace(e.first, e.second);
+		}
+		small_map(const small_map& other)
+			: small_map{} {
+			*this = other;
+		}
+		small_map(small_map&& other) noexcept
+			: small_map{} {
+			steal(other);
+		}
+		~small_map() {
+			clear();
+			deallocate();
+		}
+
+		small_map& operator=(const small_map& other) {
+			if (this == &other) return *this;
+			clear();
+			reserve(other.m_size);
+			// Counted per entry, a copy that throws leaves the entries copied so far to be destroyed
+			for (; m_size < other.m_size; m_size++)
+				new (m_data + m_size) value_type(other.m_data[m_size]);
+			return *this;
+		}
+		small_map& operator=(small_map&& other) noexcept {
+			if (this == &other) return *this;
+			clear();
+			deallocate();
+			m_data = inline_data();
+			m_capacity = N;
+			steal(other);
+			return *this;
+		}
+
+		operator std::unordered_map<TKey, TValue>() const { return std::unordered_map<TKey, TValue>(begin(), end()); }
+
+		iterator begin() noexcept { return m_data; }
+		iterator end() noexcept { return m_data + m_size; }
+		const_iterator begin() const noexcept { return m_data; }
+		const_iterator end() const noexcept { return m_data + m_size; }
+		const_iterator cbegin() const noexcept { return begin(); }
+		const_iterator cend() const noexcept { return end(); }
+
+		bool empty() const noexcept { return m_size == 0; }
+		size_t size() const noexcept { return m_size; }
+		size_t capacity() const noexcept { return m_capacity; }
+
+		void reserve(size_t capacity) {
+			if (capacity > m_capacity) grow(capacity);
+		}
+		/**
+		 * \brief Remove all entries, memory allocated for more than N entries is kept.
+		 */
+		void clear() noexcept {
+			for (size_t i = 0; i < m_size; i++)
+				m_data[i].~value_type();
+			m_size = 0;
+		}
+
+		template <typename K>
+		iterator lower_bound(const K& key) {
+			return std::lower_bound(begin(), end(), key, [](const value_type& e, const K& k) { return e.first < k; });
+		}
+		template <typename K>
+		const_iterator lower_bound(const K& key) const {
+			return std::lower_bound(begin(), end(), key, [](const value_type& e, const K& k) { return e.first < k; });
+		}
+		template <typename K>
+		iterator find(const K& key) {
+			auto it = lower_bound(key);
+			return it != end() && !(key < it->first) ? it : end();
+		}
+		template <typename K>
+		const_iterator find(const K& key) const {
+			auto it = lower_bound(key);
+			return it != end() && !(key < it->first) ? it : end();
+		}
+		template <typename K>
+		size_t count(const K& key) const {
+			return find(key) != end() ? 1 : 0;
+		}
+
+		TValue& at(const TKey& key) {
+			auto it = find(key);
+			if (it == end()) throw std::out_of_range("small_map::at");
+			return it->second;
+		}
+		const TValue& at(const TKey& key) const {
+			auto it = find(key);
+			if (it == end()) throw std::out_of_range("small_map::at");
+			return it->second;
+		}
+		TValue& operator[](const TKey& key) {
+			auto it = position(key);
+			if (it != end() && !(key < it->first)) return it->second;
+			return insert_at(it, value_type{key, TValue{}})->second;
+		}
+		TValue& operator[](TKey&& key) {
+			auto it = position(key);
+			if (it != end() && !(key < it->first)) return it->second;
+			return insert_at(it, value_type{std::move(key), TValue{}})->second;
+		}
+
+		/**
+		 * \brief Insert an entry unless the key exists already.
+		 */
+		template <typename... TArgs>
+		std::pair<iterator, bool> emplace(TArgs&&... args) {
+			value_type val(std::forward<TArgs>(args)...);
+			auto it = position(val.first);
+			if (it != end() && !(val.first < it->first)) return {it, false};
+			return {insert_at(it, std::move(val)), true};
+		}
+		std::pair<iterator, bool> insert(value_type val) { return emplace(std::move(val)); }
+		template <typename TArg>
+		std::pair<iterator, bool> insert_or_assign(TKey key, TArg&& val) {
+			auto it = position(key);
+			if (it != end() && !(key < it->first)) {
+				it->second = std::forward<TArg>(val);
+				return {it, false};
+			}
+			return {insert_at(it, value_type{std::move(key), std::forward<TArg>(val)}), true};
+		}
+
+		iterator erase(const_iterator pos) {
+			auto it = m_data + (pos - m_data);
+			std::move(it + 1, end(), it);
+			m_data[--m_size].~value_type();
+			return it;
+		}
+		iterator erase(iterator pos) { return erase(const_iterator{pos}); }
+		template <typename K>
+		size_t erase(const K& key) {
+			auto it = find(key);
+			if (it == end()) return 0;
+			erase(it);
+			return 1;
+		}
+
+		friend bool operator==(const small_map& lhs, const small_map& rhs) {
+			return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin());
+		}
+		friend bool operator!=(const small_map& lhs, const small_map& rhs) { return !(lhs == rhs); }
+	};
+
+	/**
+	 * \brief Options, labels and other string to string maps of the api types.
+	 */
+	using string_map = small_map<std::string, std::string>;
+} // namespace docker_plugin
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+namespace docker_plugin {
+	/**
+	 * \brief Layout of the request trace file written by plugin::enable_trace().
+	 *
+	 * The file starts with a trace_file_header followed by capacity trace_records used
+	 * as a ring. Record i lives in slot i % capacity and is valid if its seq is i + 1.
+	 * All values are in host byte order.
+	 */
+	struct trace_file_header {
+		// A function, a static array member would need a definition outside the class before C++17
+		static const char* magic_value() noexcept { return "DPCTRACE"; }
+		static constexpr uint32_t current_version = 1;
+
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+		uint64_t capacity;
+		// Index of the next record to write, only ever increases
+		uint64_t next;
+		uint8_t reserved[32];
+	};
+	static_assert(sizeof(trace_file_header) == 64, "unexpected trace header size");
+
+	struct trace_record {
+		// Index of this record plus one, zero while the record is being written
+		uint64_t seq;
+		// Time the response was finished, nanoseconds since the unix epoch
+		uint64_t timestamp_ns;
+		// Time from the complete request to the finished response
+		uint64_t duration_ns;
+		uint32_t request_size;
+		uint32_t response_size;
+		int32_t fd;
+		uint16_t status;
+		uint16_t reserved;
+		// Request path, truncated and zero padded
+		char route[88];
+	};
+	static_assert(sizeof(trace_record) == 128, "unexpected trace record size");
+} // namespace docker_plugin
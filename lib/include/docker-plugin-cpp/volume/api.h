@@ -1,8 +1,8 @@
 #pragma once
 #include "../plugin.h"
+#include "../small_map.h"
 #include <chrono>
 #include <string>
-#include <unordered_map>
 
 namespace docker_plugin {
 	namespace volume {
@@ -10,11 +10,11 @@ namespace docker_plugin {
 			std::string name{};
 			std::string mountpoint{};
 			std::chrono::system_clock::time_point created_at{};
-			std::unordered_map<std::string, std::string> status{};
+			string_map status{};
 		};
 		struct create_request {
 			std::string name{};
-			std::unordered_map<std::string, std::string> options{};
+			string_map options{};
 		};
 		struct remove_request {
 			std::string name{};
@@ -51,6 +51,19 @@ namespace docker_plugin {
 			} capabilities{};
 		};
 
+		/**
+		 * \brief Source of the volumes of a streamed list response, see driver::list_volumes().
+		 */
+		struct volume_cursor {
+			virtual ~volume_cursor() = default;
+			/**
+			 * \brief Fill info with the next volume.
+			 * info is cleared before every call, its strings keep the memory of earlier volumes.
+			 * \return false once all volumes were returned
+			 */
+			virtual bool next(volume_info& info) = 0;
+		};
+
 		struct driver {
 			virtual ~driver() = default;
 			virtual error_response create(const create_request& req) = 0;
@@ -61,6 +74,35 @@ namespace docker_plugin {
 			virtual mount_response mount(const mount_request& req) = 0;
 			virtual error_response unmount(const unmount_request& req) = 0;
 			virtual capabilities_response capabilities(const empty_type&) = 0;
+			/**
+			 * \brief Answer VolumeDriver.List by streaming the volumes instead of calling list().
+			 * The cursor is advanced on the event loop while the response is written, only as fast as
+			 * docker reads it, so the list is never held in memory as a whole. Volumes are sent in the
+			 * order the cursor returns them.
+			 * \return nullptr to answer using list()
+			 */
+			virtual std::unique_ptr<volume_cursor> list_volumes(const empty_type&) { return nullptr; }
+		};
+
+		/**
+		 * \brief Volume driver answering requests asynchronously.
+		 * Every call receives a completion token, the response is sent once it was invoked.
+		 * The request is only valid during the call, copy what is needed later.
+		 */
+		struct async_driver {
+			virtual ~async_driver() = default;
+			virtual void create(const create_request& req, completion<error_response> res) = 0;
+			virtual void list(const empty_type&, completion<list_response> res) = 0;
+			virtual void get(const get_request& req, completion<get_response> res) = 0;
+			virtual void remove(const remove_request& req, completion<error_response> res) = 0;
+			virtual void path(const path_request& req, completion<path_response> res) = 0;
+			virtual void mount(const mount_request& req, completion<mount_response> res) = 0;
+			virtual void unmount(const unmount_request& req, completion<error_response> res) = 0;
+			virtual void capabilities(const empty_type&, completion<capabilities_response> res) = 0;
+			/**
+			 * \brief Same as driver::list_volumes(), the cursor is advanced on the event loop.
+			 */
+			virtual std::unique_ptr<volume_cursor> list_volumes(const empty_type&) { return nullptr; }
 		};
 
 		inline bool operator<(const volume_info& lhs, const volume_info& rhs) {
@@ -0,0 +1,60 @@
+#include "completion_queue.h"
+#include <cerrno>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace docker_plugin {
+	completion_queue::completion_queue()
+		: m_fd{eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)} {
+		if (m_fd < 0) throw std::system_error(errno, std::system_category(), "eventfd");
+	}
+
+	completion_queue::~completion_queue() {
+		auto n = m_head.exchange(nullptr);
+		while (n != nullptr) {
+			std::unique_ptr<node> cur{n};
+			n = n->next;
+		}
+		::close(m_fd);
+	}
+
+	void completion_queue::push(std::weak_ptr<uds_connection> con, uint32_t generation, std::function<void()> fn) {
+		link(new node{nullptr, false, generation, std::move(con), std::move(fn)});
+	}
+
+	void completion_queue::push(std::function<void()> fn) {
+		link(new node{nullptr, true, 0, {}, std::move(fn)});
+	}
+
+	void completion_queue::link(node* n) noexcept {
+		auto head = m_head.load(std::memory_order_relaxed);
+		do {
+			n->next = head;
+		} while (!m_head.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+		// Whoever made the list non empty wakes up the loop, it takes everything pushed until then.
+		// n belongs to the loop from here on, only the old head may be looked at.
+		if (head == nullptr) {
+			uint64_t one = 1;
+			while (::write(m_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+			}
+		}
+	}
+
+	completion_queue::node* completion_queue::take() noexcept {
+		uint64_t val;
+		while (::read(m_fd, &val, sizeof(val)) < 0 && errno == EINTR) {
+		}
+		// Reverse the LIFO list to get push order
+		auto n = m_head.exchange(nullptr, std::memory_order_acquire);
+		node* res = nullptr;
+		while (n != nullptr) {
+			auto next = n->next;
+			n->next = res;
+			res = n;
+			n = next;
+		}
+		return res;
+	}
+} // namespace docker_plugin
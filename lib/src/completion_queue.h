@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace docker_plugin {
+	class uds_connection;
+
+	/**
+	 * \brief Hands work from arbitrary threads back to the event loop.
+	 *
+	 * Producers push onto an intrusive list with a single CAS, the event loop takes
+	 * the whole list at once. The eventfd is only written when the list goes from
+	 * empty to non empty, so a burst of completions costs a single wakeup.
+	 */
+	class completion_queue {
+		completion_queue(const completion_queue&) = delete;
+		completion_queue& operator=(const completion_queue&) = delete;
+
+		struct node {
+			node* next;
+			// Not bound to a connection, always called
+			bool unbound;
+			// Generation of con when pushed, connection objects are reused
+			uint32_t generation;
+			std::weak_ptr<uds_connection> con;
+			std::function<void()> fn;
+		};
+
+		std::atomic<node*> m_head{nullptr};
+		int m_fd;
+
+		void link(node* n) noexcept;
+		node* take() noexcept;
+
+	public:
+		completion_queue();
+		~completion_queue();
+
+		int get_fd() const noexcept { return m_fd; }
+
+		/**
+		 * \brief Queue fn to be called on the event loop for con. Thread safe.
+		 */
+		void push(std::weak_ptr<uds_connection> con, uint32_t generation, std::function<void()> fn);
+		/**
+		 * \brief Queue fn to be called on the event loop. Thread safe.
+		 */
+		void push(std::function<void()> fn);
+
+		/**
+		 * \brief Call handler(con, generation, fn) for everything queued so far, in push order. Event loop only.
+		 * Functions pushed without a connection are called directly.
+		 */
+		template <typename TFn>
+		size_t drain(TFn&& handler) {
+			size_t res = 0;
+			for (auto n = take(); n != nullptr; res++) {
+				std::unique_ptr<node> cur{n};
+				n = n->next;
+				if (cur->unbound)
+					cur->fn();
+				else
+					handler(cur->con, cur->generation, cur->fn);
+			}
+			return res;
+		}
+	};
+} // namespace docker_plugin
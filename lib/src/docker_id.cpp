@@ -0,0 +1,96 @@
+#include "docker-plugin-cpp/docker_id.h"
+#include <algorithm>
+
+namespace docker_plugin {
+	namespace {
+		constexpr char hex_digits[] = "0123456789abcdef";
+
+		// Only lower case, upper case ids would not format back the same way
+		int hex_value(char c) noexcept {
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			return -1;
+		}
+	} // namespace
+
+	docker_id& docker_id::operator=(const docker_id& other) {
+		if (this == &other) return *this;
+		if (other.m_hex) {
+			memcpy(m_data, other.m_data, other.m_size);
+			m_size = other.m_size;
+			m_hex = true;
+		} else
+			assign(other.text(), other.m_size);
+		return *this;
+	}
+
+	docker_id& docker_id::operator=(docker_id&& other) noexcept {
+		if (this == &other) return *this;
+		// Long text changes owner, other keeps the buffer of this id for reuse
+		if (other.m_size > inline_capacity) {
+			std::swap(m_long, other.m_long);
+			std::swap(m_long_capacity, other.m_long_capacity);
+		} else
+			memcpy(m_data, other.m_data, other.m_size);
+		m_size = other.m_size;
+		m_hex = other.m_hex;
+		other.clear();
+		return *this;
+	}
+
+	void docker_id::assign(const char* data, size_t len) {
+		if (len == hex_length) {
+			m_hex = true;
+			for (size_t i = 0; i < hex_length / 2 && m_hex; i++) {
+				auto hi = hex_value(data[i * 2]);
+				auto lo = hex_value(data[i * 2 + 1]);
+				m_hex = hi >= 0 && lo >= 0;
+				if (m_hex) m_data[i] = static_cast<uint8_t>((hi << 4) | lo);
+			}
+			if (m_hex) {
+				m_size = hex_length / 2;
+				return;
+			}
+		}
+		if (len > inline_capacity && len > m_long_capacity) {
+			auto buf = new char[len];
+			delete[] m_long;
+			m_long = buf;
+			m_long_capacity = len;
+		}
+		m_hex = false;
+		memcpy(len > inline_capacity ? m_long : reinterpret_cast<char*>(m_data), data, len);
+		m_size = len;
+	}
+
+	size_t docker_id::format(char* out) const noexcept {
+		if (!m_hex) {
+			memcpy(out, text(), m_size);
+			return m_size;
+		}
+		for (size_t i = 0; i < m_size; i++) {
+			*out++ = hex_digits[m_data[i] >> 4];
+			*out++ = hex_digits[m_data[i] & 0xf];
+		}
+		return hex_length;
+	}
+
+	std::string docker_id::str() const {
+		if (!m_hex) return std::string(text(), m_size);
+		char buf[hex_length];
+		return std::string(buf, format(buf));
+	}
+
+	int docker_id::compare(const docker_id& lhs, const docker_id& rhs) noexcept {
+		char lhs_buf[hex_length];
+		char rhs_buf[hex_length];
+		// Text ids are compared in place, hex ids are formatted on the stack
+		auto lhs_text = lhs.m_hex ? lhs_buf : lhs.text();
+		auto rhs_text = rhs.m_hex ? rhs_buf : rhs.text();
+		auto lhs_len = lhs.m_hex ? lhs.format(lhs_buf) : lhs.m_size;
+		auto rhs_len = rhs.m_hex ? rhs.format(rhs_buf) : rhs.m_size;
+		auto res = memcmp(lhs_text, rhs_text, std::min(lhs_len, rhs_len));
+		if (res != 0) return res;
+		return lhs_len < rhs_len ? -1 : (lhs_len > rhs_len ? 1 : 0);
+	}
+} // namespace docker_plugin
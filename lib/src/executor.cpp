@@ -0,0 +1,111 @@
+#include "executor.h"
+
+namespace docker_plugin {
+	namespace {
+		// Executor and index of the worker running on this thread
+		thread_local const executor* current_executor = nullptr;
+		thread_local size_t current_worker = 0;
+	} // namespace
+
+	executor::executor(size_t threads) {
+		if (threads == 0) threads = 1;
+		for (size_t i = 0; i < threads; i++)
+			m_workers.emplace_back(std::make_unique<worker>());
+		for (size_t i = 0; i < threads; i++)
+			m_threads.emplace_back(&executor::run_worker, this, i);
+	}
+
+	executor::~executor() {
+		{
+			std::lock_guard<std::mutex> lck{m_sleep_lock};
+			m_stop = true;
+		}
+		m_wakeup.notify_all();
+		for (auto& e : m_threads)
+			e.join();
+	}
+
+	void executor::post(uint64_t key, task fn) {
+		// Work created by a worker stays on it, everything else is spread round robin
+		auto idx = current_executor == this ? current_worker : m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+		if (key == 0) return schedule(idx, std::move(fn));
+		{
+			std::lock_guard<std::mutex> lck{m_strand_lock};
+			auto it = m_strands.find(key);
+			if (it != m_strands.end()) {
+				it->second.emplace_back(std::move(fn));
+				return;
+			}
+			m_strands.emplace(key, std::deque<task>{});
+		}
+		schedule(idx, [this, key, fn = std::move(fn)]() {
+			fn();
+			finish_strand(current_worker, key);
+		});
+	}
+
+	void executor::finish_strand(size_t idx, uint64_t key) {
+		task next;
+		{
+			std::lock_guard<std::mutex> lck{m_strand_lock};
+			auto it = m_strands.find(key);
+			if (it->second.empty()) {
+				m_strands.erase(it);
+				return;
+			}
+			next = std::move(it->second.front());
+			it->second.pop_front();
+		}
+		schedule(idx, [this, key, fn = std::move(next)]() {
+			fn();
+			finish_strand(current_worker, key);
+		});
+	}
+
+	void executor::schedule(size_t idx, task fn) {
+		m_queued.fetch_add(1, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lck{m_workers[idx]->lock};
+			m_workers[idx]->tasks.emplace_back(std::move(fn));
+		}
+		// Taking the lock orders this against a worker checking m_queued before going to sleep
+		{ std::lock_guard<std::mutex> lck{m_sleep_lock}; }
+		m_wakeup.notify_one();
+	}
+
+	bool executor::pop(size_t idx, task& out) {
+		// Own queue first, oldest task first
+		for (size_t i = 0; i < m_workers.size(); i++) {
+			auto& w = *m_workers[(idx + i) % m_workers.size()];
+			std::lock_guard<std::mutex> lck{w.lock};
+			if (w.tasks.empty()) continue;
+			if (i == 0) {
+				out = std::move(w.tasks.front());
+				w.tasks.pop_front();
+			} else {
+				// Steal from the back, the owner keeps working on the front
+				out = std::move(w.tasks.back());
+				w.tasks.pop_back();
+			}
+			m_queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	void executor::run_worker(size_t idx) {
+		current_executor = this;
+		current_worker = idx;
+		task fn;
+		while (true) {
+			if (pop(idx, fn)) {
+				fn();
+				fn = nullptr;
+				continue;
+			}
+			std::unique_lock<std::mutex> lck{m_sleep_lock};
+			m_wakeup.wait(lck, [this]() { return m_stop || m_queued.load(std::memory_order_acquire) != 0; });
+			if (m_stop && m_queued.load(std::memory_order_acquire) == 0) return;
+		}
+	}
+} // namespace docker_plugin
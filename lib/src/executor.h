@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace docker_plugin {
+	/**
+	 * \brief Fixed size thread pool running driver calls.
+	 *
+	 * Every worker has its own queue and steals from the others once it runs
+	 * dry. Tasks posted with the same key run one after another in post order,
+	 * the next one is only queued once its predecessor finished. Tasks with
+	 * different or zero keys run in parallel.
+	 */
+	class executor {
+		executor(const executor&) = delete;
+		executor& operator=(const executor&) = delete;
+
+		using task = std::function<void()>;
+
+		struct worker {
+			std::mutex lock{};
+			std::deque<task> tasks{};
+		};
+
+		std::vector<std::unique_ptr<worker>> m_workers{};
+		std::vector<std::thread> m_threads{};
+		// Tasks waiting behind a running task with the same key, by key
+		std::mutex m_strand_lock{};
+		std::unordered_map<uint64_t, std::deque<task>> m_strands{};
+		std::mutex m_sleep_lock{};
+		std::condition_variable m_wakeup{};
+		std::atomic<size_t> m_queued{0};
+		std::atomic<size_t> m_next{0};
+		bool m_stop{false};
+
+		void schedule(size_t idx, task fn);
+		bool pop(size_t idx, task& out);
+		void run_worker(size_t idx);
+		void finish_strand(size_t idx, uint64_t key);
+
+	public:
+		explicit executor(size_t threads);
+		~executor();
+
+		size_t size() const noexcept { return m_threads.size(); }
+
+		/**
+		 * \brief Run fn on one of the workers after all tasks previously posted with key.
+		 * Keys are usually hashes, a collision only orders tasks that didn't need it. Key zero
+		 * imposes no ordering. Thread safe.
+		 */
+		void post(uint64_t key, task fn);
+	};
+} // namespace docker_plugin
@@ -1,6 +1,7 @@
 #include "http_server.h"
 #include "llhttp.h"
 #include <algorithm>
+#include <sys/uio.h>
 
 namespace docker_plugin {
 	const llhttp_settings_t& http_connection::get_settings() noexcept {
@@ -8,8 +9,12 @@ namespace docker_plugin {
 			llhttp_settings_t s{};
 			llhttp_settings_init(&s);
 			s.on_message_begin = [](llhttp_t* s) -> int {
-				static_cast<http_connection*>(s->data)->m_buffer.clear();
-				return static_cast<http_connection*>(s->data)->on_message_begin();
+				auto o = static_cast<http_connection*>(s->data);
+				o->m_buffer.clear();
+				o->m_headers.clear();
+				o->m_response_start = o->m_flushed + o->m_response_buffer.size();
+				o->arm_read_timer(o->timeouts().header);
+				return o->on_message_begin();
 			};
 			s.on_url = [](llhttp_t* s, const char* at, size_t length) -> int {
 				static_cast<http_connection*>(s->data)->m_buffer.append(at, length);
@@ -21,43 +26,46 @@ namespace docker_plugin {
 				return res;
 			};
 			s.on_header_field = [](llhttp_t* s, const char* at, size_t length) -> int {
-				static_cast<http_connection*>(s->data)->m_buffer.append(at, length);
+				auto o = static_cast<http_connection*>(s->data);
+				if (o->m_buffer_headers) o->m_headers.append_name(at, length);
 				return 0;
 			};
 			s.on_header_field_complete = [](llhttp_t* s) -> int {
 				auto o = static_cast<http_connection*>(s->data);
-				auto res = o->on_header_field(o->m_buffer);
-				if (o->m_buffer_headers) {
-					std::transform(o->m_buffer.begin(), o->m_buffer.end(), o->m_buffer.begin(), ::tolower);
-					o->m_current_header = o->m_headers.raw().emplace(std::move(o->m_buffer), "");
-				}
-				o->m_buffer.clear();
-				return res;
+				if (!o->m_buffer_headers || o->m_headers.size() == 0) return 0;
+				o->m_headers.finish_name();
+				return o->on_header_field(o->m_headers.at(o->m_headers.size() - 1).first);
 			};
 			s.on_header_value = [](llhttp_t* s, const char* at, size_t length) -> int {
-				static_cast<http_connection*>(s->data)->m_buffer.append(at, length);
+				auto o = static_cast<http_connection*>(s->data);
+				if (o->m_buffer_headers) o->m_headers.append_value(at, length);
 				return 0;
 			};
 			s.on_header_value_complete = [](llhttp_t* s) -> int {
 				auto o = static_cast<http_connection*>(s->data);
-				auto res = o->on_header_value(o->m_buffer);
-				if (o->m_buffer_headers && o->m_current_header != o->m_headers.raw().end())
-					o->m_current_header->second = o->m_buffer;
-				o->m_buffer.clear();
-				return res;
+				if (!o->m_buffer_headers || o->m_headers.size() == 0) return 0;
+				o->m_headers.finish_value();
+				return o->on_header_value(o->m_headers.at(o->m_headers.size() - 1).second);
 			};
 			s.on_headers_complete = [](llhttp_t* s) -> int {
-				static_cast<http_connection*>(s->data)->m_buffer.clear();
-				return static_cast<http_connection*>(s->data)->on_headers_complete();
+				auto o = static_cast<http_connection*>(s->data);
+				o->m_buffer.clear();
+				o->arm_read_timer(o->timeouts().body);
+				return o->on_headers_complete();
 			};
 			s.on_message_complete = [](llhttp_t* s) -> int {
 				auto o = static_cast<http_connection*>(s->data);
+				o->m_read_timer.cancel();
 				if (o->m_buffer_body) {
 					auto res = o->on_body(o->m_buffer.data(), o->m_buffer.size());
 					if (res != 0) return res;
 				} else
 					o->m_buffer.clear();
-				return o->on_message_complete();
+				auto res = o->on_message_complete();
+				// Stop parsing pipelined requests until the client has read our responses
+				// or until the response to this one is available
+				if (res == 0 && (o->write_blocked() || o->m_response_deferred)) return HPE_PAUSED;
+				return res;
 			};
 			s.on_body = [](llhttp_t* s, const char* at, size_t length) -> int {
 				auto o = static_cast<http_connection*>(s->data);
@@ -72,6 +80,45 @@ namespace docker_plugin {
 		return instance;
 	}
 
+	void http_request_headers::append_name(const char* data, size_t len) {
+		if (m_in_value) {
+			auto offset = static_cast<uint32_t>(m_data.size());
+			m_entries.push_back({offset, 0, offset, 0});
+			m_in_value = false;
+		}
+		m_data.append(data, len);
+		m_entries.back().name_length += static_cast<uint32_t>(len);
+	}
+
+	void http_request_headers::finish_name() noexcept {
+		if (m_in_value) return;
+		auto& e = m_entries.back();
+		auto name = &m_data[e.name_offset];
+		std::transform(name, name + e.name_length, name, ::tolower);
+		e.value_offset = static_cast<uint32_t>(m_data.size());
+	}
+
+	void http_request_headers::append_value(const char* data, size_t len) {
+		if (m_entries.empty() || m_in_value) return;
+		m_data.append(data, len);
+		m_entries.back().value_length += static_cast<uint32_t>(len);
+	}
+
+	const http_request_headers::entry* http_request_headers::find(std::string_view key) const noexcept {
+		for (auto& e : m_entries) {
+			if (e.name_length != key.size()) continue;
+			auto name = m_data.data() + e.name_offset;
+			if (std::equal(key.begin(), key.end(), name, [](char c1, char c2) { return tolower(c1) == c2; })) return &e;
+		}
+		return nullptr;
+	}
+
+	std::string_view http_request_headers::get(std::string_view key) const noexcept {
+		auto e = find(key);
+		if (e == nullptr) return {};
+		return {m_data.data() + e->value_offset, e->value_length};
+	}
+
 	namespace {
 		static const std::pair<int, const char*> http_status_map[] = {
 			{100, "Continue"},
@@ -141,11 +188,72 @@ namespace docker_plugin {
 	}
 
 	void http_connection::on_read(const void* data, size_t len) {
-		auto res = llhttp_execute(&m_parser, reinterpret_cast<const char*>(data), len);
+		auto ptr = static_cast<const char*>(data);
+		if (m_parser_paused) {
+			// Drop what was parsed already before buffering more
+			if (m_unparsed_offset >= max_unparsed) {
+				m_unparsed.erase(0, m_unparsed_offset);
+				m_unparsed_offset = 0;
+			}
+			m_unparsed.append(ptr, len);
+		} else {
+			auto used = parse(ptr, len);
+			if (m_parser_paused) m_unparsed.append(ptr + used, len - used);
+		}
+		// Whatever paused the parser might be gone already
+		resume_parsing();
+	}
+
+	size_t http_connection::parse(const char* data, size_t len) {
+		m_in_read = true;
+		auto res = llhttp_execute(&m_parser, data, len);
+		m_in_read = false;
+		// Responses to everything parsed above go out with a single write
+		flush_response();
+		if (res == HPE_PAUSED) {
+			m_parser_paused = true;
+			return llhttp_get_error_pos(&m_parser) - data;
+		}
 		if (res != HPE_OK) {
 			fprintf(stderr, "error parsing http request: %s %s\n", llhttp_errno_name(res), m_parser.reason);
 			this->close();
 		}
+		return len;
+	}
+
+	void http_connection::on_drain() {
+		resume_parsing();
+	}
+
+	void http_connection::on_posted() {
+		resume_parsing();
+	}
+
+	void http_connection::arm_read_timer(std::chrono::milliseconds limit) {
+		if (limit.count() <= 0) return m_read_timer.cancel();
+		schedule(m_read_timer, limit, [this]() { on_read_timeout(); });
+	}
+
+	void http_connection::on_read_timeout() {
+		// Mid request, the usual response path expects a complete one
+		static constexpr char response[] = "HTTP/1.1 408 Request Timeout\r\nconnection: close\r\ncontent-length: 0\r\n\r\n";
+		write(response, sizeof(response) - 1);
+		close();
+	}
+
+	void http_connection::resume_parsing() {
+		while (m_parser_paused && !m_response_deferred && !write_blocked()) {
+			m_parser_paused = false;
+			llhttp_resume(&m_parser);
+			// Parsed in place, if the parser pauses again the rest stays where it is
+			if (m_unparsed_offset < m_unparsed.size()) m_unparsed_offset += parse(m_unparsed.data() + m_unparsed_offset, m_unparsed.size() - m_unparsed_offset);
+		}
+		// A nested call from within parse() must not drop the input still being parsed
+		if (m_unparsed_offset == m_unparsed.size()) {
+			m_unparsed.clear();
+			m_unparsed_offset = 0;
+		}
+		pause_input(m_parser_paused && m_unparsed.size() - m_unparsed_offset >= max_unparsed);
 	}
 
 	http_connection::http_connection(int sock)
@@ -154,6 +262,33 @@ namespace docker_plugin {
 		m_parser.data = this;
 	}
 
+	bool http_connection::reset() {
+		uds_connection::reset();
+		llhttp_init(&m_parser, HTTP_REQUEST, &get_settings());
+		m_parser.data = this;
+		m_parser_paused = false;
+		m_response_deferred = false;
+		// Buffers keep their capacity for the next socket
+		m_unparsed.clear();
+		m_unparsed_offset = 0;
+		m_buffer.clear();
+		m_buffer_body = false;
+		m_buffer_headers = false;
+		m_headers.clear();
+		m_response_status = 200;
+		m_response_message = "OK";
+		m_response_headers.clear();
+		m_response_headers_sent = false;
+		m_response_chunked = false;
+		m_response_buffer.clear();
+		m_in_read = false;
+		m_body_start = 0;
+		m_flushed = 0;
+		m_response_start = 0;
+		m_read_timer.cancel();
+		return true;
+	}
+
 	void http_connection::response_status(int status, const std::string& msg) {
 		m_response_status = status;
 		if (msg.empty()) {
@@ -165,14 +300,36 @@ namespace docker_plugin {
 			m_response_message = msg;
 	}
 
-	void http_connection::send_headers() {
-		if (m_response_headers_sent) return;
-		std::string headers = "HTTP/1.1 " + std::to_string(m_response_status) + " " + m_response_message + "\r\n";
-		for (auto& e : m_response_headers.raw()) {
-			headers += e.first + ": " + e.second + "\r\n";
+	void http_connection::append_head(std::string& out, int status, const std::string& msg, const http_header_set& headers) {
+		char line[32];
+		int r = snprintf(line, sizeof(line), "HTTP/1.1 %d ", status);
+		out.append(line, r);
+		out += msg;
+		out += "\r\n";
+		for (auto& e : headers.raw()) {
+			out += e.first;
+			out += ": ";
+			out += e.second;
+			out += "\r\n";
+		}
+	}
+
+	std::string http_connection::prepare_response(int status, http_header_set headers, const std::string& body) {
+		const char* msg = "OK";
+		for (auto& e : http_status_map) {
+			if (e.first == status) msg = e.second;
 		}
-		headers += "\r\n";
-		this->write(headers.data(), headers.size());
+		headers.set("content-length", std::to_string(body.size()));
+		std::string res;
+		append_head(res, status, msg, headers);
+		res += "\r\n";
+		res += body;
+		return res;
+	}
+
+	void http_connection::append_headers() {
+		append_head(m_response_buffer, m_response_status, m_response_message, m_response_headers);
+		m_response_buffer += "\r\n";
 		m_response_headers_sent = true;
 		if (m_response_headers.get("transfer-encoding") == "chunked") m_response_chunked = true;
 
@@ -181,49 +338,126 @@ namespace docker_plugin {
 		m_response_headers.raw().clear();
 	}
 
+	void http_connection::flush_response(const iovec* extra, size_t count) {
+		struct iovec iov[4];
+		size_t n = 0;
+		if (!m_response_buffer.empty()) iov[n++] = iovec{&m_response_buffer[0], m_response_buffer.size()};
+		for (size_t i = 0; i < count && n < 4; i++)
+			iov[n++] = extra[i];
+		if (n != 0) this->writev(iov, n);
+		for (size_t i = 0; i < n; i++)
+			m_flushed += iov[i].iov_len;
+		m_response_buffer.clear();
+	}
+
+	void http_connection::send_headers() {
+		if (m_response_headers_sent) return;
+		append_headers();
+		if (!m_in_read) flush_response();
+	}
+
 	void http_connection::send_data(const void* data, size_t len) {
 		if (!m_response_headers_sent) {
 			if (!response_headers().has("content-length") && !response_headers().has("transfer-encoding")) {
 				response_headers().set("transfer-encoding", "chunked");
 			}
-			this->send_headers();
+			append_headers();
 		}
+		auto ptr = static_cast<char*>(const_cast<void*>(data));
 		if (m_response_chunked) {
 			while (len != 0) {
 				uint32_t small_len = std::min<size_t>(len, UINT16_MAX);
 				char len_buf[16];
 				int r = snprintf(len_buf, sizeof(len_buf), "%x\r\n", static_cast<unsigned int>(small_len));
-				this->write(len_buf, r);
-				this->write(data, small_len);
-				this->write("\r\n", 2);
+				m_response_buffer.append(len_buf, r);
+				if (small_len >= zero_copy_threshold) {
+					struct iovec iov[2] = {{ptr, small_len}, {const_cast<char*>("\r\n"), 2}};
+					flush_response(iov, 2);
+				} else {
+					m_response_buffer.append(ptr, small_len);
+					m_response_buffer.append("\r\n", 2);
+				}
+				ptr += small_len;
 				len -= small_len;
 			}
+		} else if (len >= zero_copy_threshold) {
+			struct iovec iov {
+				ptr, len
+			};
+			flush_response(&iov, 1);
 		} else {
-			this->write(data, len);
+			m_response_buffer.append(ptr, len);
 		}
+		if (!m_in_read || m_response_buffer.size() >= batch_limit) flush_response();
 	}
 
 	void http_connection::end() {
 		if (!m_response_headers_sent) {
 			if (!response_headers().has("content-length"))
 				response_headers().set("content-length", "0");
-			send_headers();
+			append_headers();
 		}
 		if (m_response_chunked) {
-			this->write("0\r\n\r\n", 5);
+			m_response_buffer.append("0\r\n\r\n", 5);
 		}
+		finish_message();
+	}
+
+	std::string& http_connection::begin_body() {
+		m_response_headers.erase("content-length");
+		append_head(m_response_buffer, m_response_status, m_response_message, m_response_headers);
+		// Blank room for the length, the whitespace before the value is skipped by parsers
+		m_response_buffer.append("content-length: ");
+		m_response_buffer.append(content_length_digits, ' ');
+		m_response_buffer.append("\r\n\r\n");
+		m_body_start = m_response_buffer.size();
+		return m_response_buffer;
+	}
+
+	void http_connection::end_body() {
+		// Filled in right aligned, so the body never has to move
+		auto len = m_response_buffer.size() - m_body_start;
+		auto pos = m_body_start - 4;
+		do {
+			m_response_buffer[--pos] = static_cast<char>('0' + len % 10);
+			len /= 10;
+		} while (len != 0);
+		finish_message();
+	}
+
+	void http_connection::end_prepared(const std::string& response) {
+		if (m_response_headers_sent) {
+			// Can't mix a prepared response with one already started, finish that one instead
+			return end();
+		}
+		if (response.size() >= zero_copy_threshold) {
+			struct iovec iov {
+				const_cast<char*>(response.data()), response.size()
+			};
+			flush_response(&iov, 1);
+		} else
+			m_response_buffer += response;
+		finish_message();
+	}
+
+	void http_connection::finish_message() {
+		auto status = m_response_status;
+		auto size = m_flushed + m_response_buffer.size() - m_response_start;
+		if (!m_in_read || m_response_buffer.size() >= batch_limit) flush_response();
+		m_response_start = m_flushed + m_response_buffer.size();
 
 		// Clean up state and reset everything
 		m_buffer.clear();
 		m_buffer_body = false;
 		m_buffer_headers = false;
 		m_headers.clear();
-		m_current_header = {};
 		m_response_status = 200;
 		m_response_message.clear();
 		m_response_headers.clear();
 		m_response_headers_sent = false;
 		m_response_chunked = false;
+		m_response_deferred = false;
+		on_response_complete(status, size);
 	}
 
 	void http_connection::end(const void* data, size_t len) {
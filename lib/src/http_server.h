@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <llhttp.h>
 #include <map>
+#include <string_view>
+#include <vector>
 
 namespace docker_plugin {
 	struct case_insensitive_less {
@@ -39,28 +41,120 @@ namespace docker_plugin {
 		collection_type m_headers{};
 	};
 
+	/**
+	 * \brief Flat storage for the headers of the request currently being parsed.
+	 *
+	 * Names and values are copied back to back into a single buffer and referenced
+	 * by offset. The buffer and the index keep their capacity between requests, so
+	 * once a connection has seen its largest request no further allocations happen.
+	 * Names are stored lowercased. Views returned by get() and at() are valid until
+	 * the next header is added or the store is cleared.
+	 */
+	class http_request_headers {
+		struct entry {
+			uint32_t name_offset;
+			uint32_t name_length;
+			uint32_t value_offset;
+			uint32_t value_length;
+		};
+		std::string m_data{};
+		std::vector<entry> m_entries{};
+		bool m_in_value{true};
+
+		const entry* find(std::string_view key) const noexcept;
+
+	public:
+		void append_name(const char* data, size_t len);
+		void finish_name() noexcept;
+		void append_value(const char* data, size_t len);
+		void finish_value() noexcept { m_in_value = true; }
+
+		std::string_view get(std::string_view key) const noexcept;
+		bool has(std::string_view key) const noexcept { return find(key) != nullptr; }
+		std::pair<std::string_view, std::string_view> at(size_t idx) const noexcept {
+			auto& e = m_entries[idx];
+			return {{m_data.data() + e.name_offset, e.name_length}, {m_data.data() + e.value_offset, e.value_length}};
+		}
+		size_t size() const noexcept { return m_entries.size(); }
+		void clear() noexcept {
+			m_data.clear();
+			m_entries.clear();
+			m_in_value = true;
+		}
+	};
+
 	class http_connection : public uds_connection {
 		llhttp_t m_parser{};
+		bool m_parser_paused{false};
+		// The handler answers the current request later, parsing stops until it did
+		bool m_response_deferred{false};
+		// Input received while parsing is paused, parsing resumes at m_unparsed_offset
+		std::string m_unparsed{};
+		size_t m_unparsed_offset{0};
 		std::string m_buffer{};
 		bool m_buffer_body{false};
+		// Headers are skipped entirely unless a handler asks for them using buffer_headers()
 		bool m_buffer_headers{false};
-		http_header_set m_headers{};
-		http_header_set::collection_type::iterator m_current_header{};
+		http_request_headers m_headers{};
 
 		int m_response_status{200};
 		std::string m_response_message{"OK"};
 		http_header_set m_response_headers{};
 		bool m_response_headers_sent{false};
 		bool m_response_chunked{false};
+		// Response bytes assembled but not yet handed to the connection. While parsing
+		// input, responses to pipelined requests are collected and written together.
+		std::string m_response_buffer{};
+		bool m_in_read{false};
+		// Start of the body written using begin_body() in m_response_buffer
+		size_t m_body_start{0};
+		// Response bytes handed to the connection so far and the total when the current request started
+		size_t m_flushed{0};
+		size_t m_response_start{0};
+		// Limits receiving the headers and then the body of the current request
+		timer m_read_timer{};
+
+		// Bodies at least this large are passed to writev instead of being copied
+		static constexpr size_t zero_copy_threshold = 16 * 1024;
+		// Buffered output is written once it reaches this size, even while parsing
+		static constexpr size_t batch_limit = 64 * 1024;
+		// Room begin_body() leaves for the content-length, enough for any size_t
+		static constexpr size_t content_length_digits = 20;
+		// Reading stops once this much input waits for parsing to resume. Below it the socket
+		// stays readable, so a client that hangs up during a deferred response is noticed.
+		static constexpr size_t max_unparsed = 64 * 1024;
 
 		static const llhttp_settings_t& get_settings() noexcept;
+		// Status line and headers, without the blank line ending the head
+		static void append_head(std::string& out, int status, const std::string& msg, const http_header_set& headers);
+		void append_headers();
+		void finish_message();
+		void flush_response(const iovec* extra = nullptr, size_t count = 0);
+		size_t parse(const char* data, size_t len);
+		void resume_parsing();
+		void arm_read_timer(std::chrono::milliseconds limit);
+		void on_read_timeout();
 
 	protected:
 		void on_read(const void* data, size_t len) override;
+		void on_drain() override;
+		void on_posted() override;
+		bool busy() const noexcept override { return m_response_deferred || m_parser_paused || uds_connection::busy(); }
+		bool reset() override;
 		void buffer_body() noexcept { m_buffer_body = true; }
 		void buffer_headers() noexcept { m_buffer_headers = true; }
-		const http_header_set& request_headers() const noexcept { return m_headers; }
+		const http_request_headers& request_headers() const noexcept { return m_headers; }
 		const std::string& body() const noexcept { return m_buffer; }
+		/**
+		 * \brief Announce that the current request is answered after on_message_complete() returned.
+		 * Pipelined requests are not parsed until the response was finished, usually from a
+		 * function posted to the event loop using handle().
+		 */
+		void defer_response() noexcept { m_response_deferred = true; }
+		/**
+		 * \brief Called once the response to a request is complete, with its status and size including the head.
+		 */
+		virtual void on_response_complete(int, size_t) {}
 
 		void response_status(int status, const std::string& msg = "");
 		http_header_set& response_headers() noexcept { return m_response_headers; }
@@ -70,14 +164,36 @@ namespace docker_plugin {
 		void end();
 		void end(const void* data, size_t len);
 		void end(const std::string& data) { end(data.data(), data.size()); }
+		/**
+		 * \brief Write the response body directly into the output buffer.
+		 * Everything appended to the returned buffer until end_body() is sent as body, preceded
+		 * by the status and headers set so far plus a matching content-length. The head is written
+		 * right away, later changes to status or headers have no effect. Can't be mixed with
+		 * send_headers() or send_data() for the same response.
+		 */
+		std::string& begin_body();
+		/**
+		 * \brief Finish a response started with begin_body() and the request.
+		 */
+		void end_body();
+		/**
+		 * \brief Send a complete response created using prepare_response() and finish the request.
+		 */
+		void end_prepared(const std::string& response);
+
+		/**
+		 * \brief Serialize a complete response, including status line and headers, for later use with end_prepared().
+		 */
+		static std::string prepare_response(int status, http_header_set headers, const std::string& body);
 
 	public:
 		http_connection(int sock);
 
 		virtual int on_message_begin() noexcept { return 0; }
 		virtual int on_url(llhttp_method, const std::string&) noexcept { return 0; }
-		virtual int on_header_field(const std::string&) noexcept { return 0; }
-		virtual int on_header_value(const std::string&) noexcept { return 0; }
+		// Only called for connections that requested buffer_headers()
+		virtual int on_header_field(std::string_view) noexcept { return 0; }
+		virtual int on_header_value(std::string_view) noexcept { return 0; }
 		virtual int on_headers_complete() noexcept { return 0; }
 		virtual int on_body(const void*, size_t) noexcept { return 0; }
 		virtual int on_message_complete() noexcept { return 0; }
@@ -102,8 +218,8 @@ namespace docker_plugin {
 		}
 
 	public:
-		http_server(logger* log, TExtra... args)
-			: uds_server(log), m_extra_args{args...} {}
+		http_server(logger* log, io_backend backend, TExtra... args)
+			: uds_server(log, backend), m_extra_args{args...} {}
 		~http_server() {}
 	};
 } // namespace docker_plugin
\ No newline at end of file
@@ -0,0 +1,303 @@
+#include "json_reader.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace docker_plugin {
+	namespace {
+		// Nesting limit for skipped values, same as the previously used picojson
+		constexpr size_t max_depth = 100;
+
+		int hex_value(char c) noexcept {
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		}
+
+		void append_utf8(std::string& out, uint32_t cp) {
+			if (cp < 0x80) {
+				out += static_cast<char>(cp);
+			} else if (cp < 0x800) {
+				out += static_cast<char>(0xc0 | (cp >> 6));
+				out += static_cast<char>(0x80 | (cp & 0x3f));
+			} else if (cp < 0x10000) {
+				out += static_cast<char>(0xe0 | (cp >> 12));
+				out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+				out += static_cast<char>(0x80 | (cp & 0x3f));
+			} else {
+				out += static_cast<char>(0xf0 | (cp >> 18));
+				out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+				out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+				out += static_cast<char>(0x80 | (cp & 0x3f));
+			}
+		}
+	} // namespace
+
+	void json_reader::fail(const char* msg) const {
+		if (m_pos == m_end) throw std::invalid_argument(std::string{msg} + " at end of input");
+		throw std::invalid_argument(std::string{msg} + " near '" + std::string(m_pos, std::min<size_t>(m_end - m_pos, 16)) + "'");
+	}
+
+	char json_reader::skip_ws() noexcept {
+		while (m_pos != m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r'))
+			m_pos++;
+		return m_pos == m_end ? '\0' : *m_pos;
+	}
+
+	void json_reader::expect(char c) {
+		if (skip_ws() != c || m_pos == m_end) fail("syntax error");
+		m_pos++;
+	}
+
+	void json_reader::scan_literal(const char* lit) {
+		auto len = strlen(lit);
+		if (static_cast<size_t>(m_end - m_pos) < len || memcmp(m_pos, lit, len) != 0) fail("invalid literal");
+		m_pos += len;
+	}
+
+	void json_reader::scan_number(bool* is_integer, int64_t* value) {
+		bool negative = false;
+		bool integer = true;
+		uint64_t val = 0;
+		if (m_pos != m_end && *m_pos == '-') {
+			negative = true;
+			m_pos++;
+		}
+		if (m_pos == m_end || *m_pos < '0' || *m_pos > '9') fail("invalid number");
+		if (*m_pos == '0') {
+			m_pos++;
+		} else {
+			while (m_pos != m_end && *m_pos >= '0' && *m_pos <= '9') {
+				uint64_t digit = *m_pos - '0';
+				if (val > (UINT64_MAX - digit) / 10)
+					integer = false;
+				else
+					val = val * 10 + digit;
+				m_pos++;
+			}
+		}
+		if (m_pos != m_end && *m_pos == '.') {
+			integer = false;
+			m_pos++;
+			if (m_pos == m_end || *m_pos < '0' || *m_pos > '9') fail("invalid number");
+			while (m_pos != m_end && *m_pos >= '0' && *m_pos <= '9')
+				m_pos++;
+		}
+		if (m_pos != m_end && (*m_pos == 'e' || *m_pos == 'E')) {
+			integer = false;
+			m_pos++;
+			if (m_pos != m_end && (*m_pos == '+' || *m_pos == '-')) m_pos++;
+			if (m_pos == m_end || *m_pos < '0' || *m_pos > '9') fail("invalid number");
+			while (m_pos != m_end && *m_pos >= '0' && *m_pos <= '9')
+				m_pos++;
+		}
+		if (integer && val > (negative ? static_cast<uint64_t>(INT64_MAX) + 1 : static_cast<uint64_t>(INT64_MAX))) integer = false;
+		if (is_integer) *is_integer = integer;
+		if (value && integer) *value = negative ? static_cast<int64_t>(0 - val) : static_cast<int64_t>(val);
+	}
+
+	void json_reader::scan_string(std::string* out) {
+		expect('"');
+		for (;;) {
+			auto start = m_pos;
+			while (m_pos != m_end && *m_pos != '"' && *m_pos != '\\')
+				m_pos++;
+			if (out) out->append(start, m_pos);
+			if (m_pos == m_end) fail("unterminated string");
+			if (*m_pos++ == '"') return;
+			if (m_pos == m_end) fail("unterminated string");
+			char c = *m_pos++;
+			char unescaped;
+			switch (c) {
+			case '"': unescaped = '"'; break;
+			case '\\': unescaped = '\\'; break;
+			case '/': unescaped = '/'; break;
+			case 'b': unescaped = '\b'; break;
+			case 'f': unescaped = '\f'; break;
+			case 'n': unescaped = '\n'; break;
+			case 'r': unescaped = '\r'; break;
+			case 't': unescaped = '\t'; break;
+			case 'u': {
+				auto read_hex4 = [this]() {
+					if (m_end - m_pos < 4) fail("invalid unicode escape");
+					uint32_t res = 0;
+					for (int i = 0; i < 4; i++) {
+						auto v = hex_value(*m_pos++);
+						if (v < 0) fail("invalid unicode escape");
+						res = (res << 4) | v;
+					}
+					return res;
+				};
+				auto cp = read_hex4();
+				if (cp >= 0xdc00 && cp <= 0xdfff) fail("invalid unicode escape");
+				if (cp >= 0xd800 && cp <= 0xdbff) {
+					if (m_end - m_pos < 2 || m_pos[0] != '\\' || m_pos[1] != 'u') fail("invalid unicode escape");
+					m_pos += 2;
+					auto low = read_hex4();
+					if (low < 0xdc00 || low > 0xdfff) fail("invalid unicode escape");
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+				}
+				if (out) append_utf8(*out, cp);
+				continue;
+			}
+			default: fail("invalid escape sequence");
+			}
+			if (out) *out += unescaped;
+		}
+	}
+
+	json_reader::type json_reader::peek() {
+		switch (skip_ws()) {
+		case '{': return type::object;
+		case '[': return type::array;
+		case '"': return type::string;
+		case 't':
+		case 'f': return type::boolean;
+		case 'n': return type::null;
+		case '-':
+		case '0':
+		case '1':
+		case '2':
+		case '3':
+		case '4':
+		case '5':
+		case '6':
+		case '7':
+		case '8':
+		case '9': return type::number;
+		default: fail("unexpected character");
+		}
+	}
+
+	void json_reader::begin_object() {
+		expect('{');
+		m_first = true;
+	}
+
+	bool json_reader::next_member(std::string_view& key) {
+		char c = skip_ws();
+		if (c == '}') {
+			m_pos++;
+			m_first = false;
+			return false;
+		}
+		if (!m_first) {
+			expect(',');
+			c = skip_ws();
+		}
+		m_first = false;
+		if (c != '"') fail("expected member name");
+		// Member names rarely contain escapes, refer to the input directly if possible
+		auto start = m_pos + 1;
+		auto end = start;
+		while (end != m_end && *end != '"' && *end != '\\')
+			end++;
+		if (end != m_end && *end == '"') {
+			key = std::string_view(start, end - start);
+			m_pos = end + 1;
+		} else {
+			m_key.clear();
+			scan_string(&m_key);
+			key = m_key;
+		}
+		expect(':');
+		return true;
+	}
+
+	void json_reader::begin_array() {
+		expect('[');
+		m_first = true;
+	}
+
+	bool json_reader::next_element() {
+		if (skip_ws() == ']') {
+			m_pos++;
+			m_first = false;
+			return false;
+		}
+		if (!m_first) expect(',');
+		m_first = false;
+		return true;
+	}
+
+	void json_reader::skip() {
+		// Iterative, so hostile nesting can't exhaust the stack
+		char stack[max_depth];
+		size_t depth = 0;
+		for (;;) {
+			switch (peek()) {
+			case type::object:
+				if (depth == max_depth) fail("nesting too deep");
+				begin_object();
+				stack[depth++] = '{';
+				break;
+			case type::array:
+				if (depth == max_depth) fail("nesting too deep");
+				begin_array();
+				stack[depth++] = '[';
+				break;
+			case type::string: scan_string(nullptr); break;
+			case type::number: scan_number(nullptr, nullptr); break;
+			case type::boolean: scan_literal(*m_pos == 't' ? "true" : "false"); break;
+			case type::null: scan_literal("null"); break;
+			}
+			while (depth != 0) {
+				std::string_view key;
+				if (stack[depth - 1] == '{' ? next_member(key) : next_element()) break;
+				depth--;
+			}
+			if (depth == 0) return;
+		}
+	}
+
+	bool json_reader::read(std::string& out) {
+		if (peek() != type::string) {
+			skip();
+			return false;
+		}
+		out.clear();
+		scan_string(&out);
+		return true;
+	}
+
+	bool json_reader::read(std::string_view& out) {
+		if (peek() != type::string) {
+			skip();
+			return false;
+		}
+		auto start = m_pos + 1;
+		auto end = start;
+		while (end != m_end && *end != '"' && *end != '\\')
+			end++;
+		if (end != m_end && *end == '"') {
+			out = std::string_view(start, end - start);
+			m_pos = end + 1;
+			return true;
+		}
+		m_value.clear();
+		scan_string(&m_value);
+		out = m_value;
+		return true;
+	}
+
+	bool json_reader::read(bool& out) {
+		if (peek() != type::boolean) {
+			skip();
+			return false;
+		}
+		out = *m_pos == 't';
+		scan_literal(out ? "true" : "false");
+		return true;
+	}
+
+	bool json_reader::read(int64_t& out) {
+		if (peek() != type::number) {
+			skip();
+			return false;
+		}
+		bool integer;
+		scan_number(&integer, &out);
+		return integer;
+	}
+} // namespace docker_plugin
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace docker_plugin {
+	/**
+	 * \brief Single pass pull parser for json documents.
+	 *
+	 * Values are consumed in document order straight from the input, no tree is
+	 * built. Objects are walked using begin_object()/next_member() and arrays using
+	 * begin_array()/next_element(), every member or element has to be consumed by
+	 * exactly one read or skip() call before advancing. Malformed input throws
+	 * std::invalid_argument.
+	 */
+	class json_reader {
+		json_reader(const json_reader&) = delete;
+		json_reader& operator=(const json_reader&) = delete;
+
+		const char* m_pos;
+		const char* m_end;
+		// Set right after opening a container, to know whether a separator is expected
+		bool m_first{false};
+		// Storage for keys that contain escape sequences
+		std::string m_key{};
+		// Storage for string values read as a view that contain escape sequences
+		std::string m_value{};
+
+		[[noreturn]] void fail(const char* msg) const;
+		char skip_ws() noexcept;
+		void expect(char c);
+		void scan_number(bool* is_integer, int64_t* value);
+		void scan_literal(const char* lit);
+		void scan_string(std::string* out);
+
+	public:
+		enum class type {
+			null,
+			boolean,
+			number,
+			string,
+			array,
+			object
+		};
+
+		explicit json_reader(std::string_view doc) noexcept
+			: m_pos{doc.data()}, m_end{doc.data() + doc.size()} {}
+
+		/**
+		 * \brief Type of the next value, without consuming it.
+		 */
+		type peek();
+
+		void begin_object();
+		/**
+		 * \brief Advance to the next member of the current object.
+		 * \param key Receives the member name, valid until the member value was consumed.
+		 * \return false once the end of the object was consumed.
+		 */
+		bool next_member(std::string_view& key);
+		void begin_array();
+		/**
+		 * \brief Advance to the next element of the current array.
+		 * \return false once the end of the array was consumed.
+		 */
+		bool next_element();
+
+		/**
+		 * \brief Consume the next value, whatever its type.
+		 */
+		void skip();
+
+		// The read functions below consume the next value. If it has a different
+		// type it is skipped and false is returned, leaving out untouched.
+		bool read(std::string& out);
+		/**
+		 * \brief Read a string without copying it unless it contains escapes.
+		 * \param out Receives the string, valid until the next string value is read this way.
+		 */
+		bool read(std::string_view& out);
+		bool read(bool& out);
+		bool read(int64_t& out);
+	};
+} // namespace docker_plugin
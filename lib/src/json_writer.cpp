@@ -0,0 +1,39 @@
+#include "json_writer.h"
+#include <cstdio>
+
+namespace docker_plugin {
+	void json_writer::write_string(std::string_view str) {
+		m_out += '"';
+		auto start = str.data();
+		auto end = str.data() + str.size();
+		for (auto ptr = start; ptr != end; ptr++) {
+			auto c = static_cast<unsigned char>(*ptr);
+			if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7f) continue;
+			m_out.append(start, ptr);
+			start = ptr + 1;
+			switch (c) {
+			case '"': m_out += "\\\""; break;
+			case '\\': m_out += "\\\\"; break;
+			case '\b': m_out += "\\b"; break;
+			case '\f': m_out += "\\f"; break;
+			case '\n': m_out += "\\n"; break;
+			case '\r': m_out += "\\r"; break;
+			case '\t': m_out += "\\t"; break;
+			default: {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				m_out += buf;
+			}
+			}
+		}
+		m_out.append(start, end);
+		m_out += '"';
+	}
+
+	void json_writer::value(int64_t i) {
+		separator();
+		char buf[24];
+		int r = snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(i));
+		m_out.append(buf, r);
+	}
+} // namespace docker_plugin
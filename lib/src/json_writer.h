@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace docker_plugin {
+	/**
+	 * \brief Streaming json writer appending to an existing buffer.
+	 *
+	 * Separators are inserted automatically, the caller only has to emit keys and
+	 * values in order. Nothing is allocated besides growing the target buffer.
+	 */
+	class json_writer {
+		json_writer(const json_writer&) = delete;
+		json_writer& operator=(const json_writer&) = delete;
+
+		std::string& m_out;
+		// No separator needed before the next value
+		bool m_first{true};
+
+		void separator() {
+			if (!m_first) m_out += ',';
+			m_first = false;
+		}
+		void write_string(std::string_view str);
+
+	public:
+		explicit json_writer(std::string& out) noexcept
+			: m_out{out} {}
+
+		void begin_object() {
+			separator();
+			m_out += '{';
+			m_first = true;
+		}
+		void end_object() {
+			m_out += '}';
+			m_first = false;
+		}
+		void begin_array() {
+			separator();
+			m_out += '[';
+			m_first = true;
+		}
+		void end_array() {
+			m_out += ']';
+			m_first = false;
+		}
+		void key(std::string_view name) {
+			separator();
+			write_string(name);
+			m_out += ':';
+			m_first = true;
+		}
+
+		void value(std::string_view str) {
+			separator();
+			write_string(str);
+		}
+		void value(const char* str) { value(std::string_view{str}); }
+		void value(const std::string& str) { value(std::string_view{str}); }
+		void value(bool b) {
+			separator();
+			m_out += b ? "true" : "false";
+		}
+		void value(int64_t i);
+
+		template <typename T>
+		void member(std::string_view name, const T& val) {
+			key(name);
+			value(val);
+		}
+	};
+} // namespace docker_plugin
@@ -1,5 +1,10 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <docker-plugin-cpp/logger.h>
+#include <mutex>
+#include <thread>
 
 namespace docker_plugin {
 
@@ -18,4 +23,131 @@ namespace docker_plugin {
 		printf("%s %s %s\n", buffer, levels[static_cast<int>(l)], msg.c_str());
 	}
 
-} // namespace docker_plugin
\ No newline at end of file
+	/**
+	 * \brief Bounded multi producer ring, every slot carries a sequence number.
+	 *
+	 * A slot is free for position pos if its sequence equals pos and readable once it
+	 * is pos + 1. Producers claim a position with a CAS on m_head, the single consumer
+	 * owns m_tail. Slot strings keep their capacity, so once warmed up logging does
+	 * not allocate.
+	 */
+	struct async_logger::state {
+		struct slot {
+			std::atomic<size_t> seq{0};
+			level lvl{};
+			std::string msg{};
+		};
+
+		const logger& sink;
+		std::unique_ptr<slot[]> slots;
+		size_t mask;
+		std::atomic<size_t> head{0};
+		size_t tail{0};
+		std::atomic<size_t> dropped{0};
+		std::atomic<bool> stop{false};
+		std::atomic<bool> sleeping{false};
+		std::mutex lock{};
+		std::condition_variable wakeup{};
+		std::thread thread{};
+
+		state(const logger& s, size_t capacity)
+			: sink{s}, slots{}, mask{0} {
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			slots.reset(new slot[size]);
+			for (size_t i = 0; i < size; i++)
+				slots[i].seq.store(i, std::memory_order_relaxed);
+			mask = size - 1;
+		}
+
+		void push(level l, const std::string& msg) noexcept {
+			auto pos = head.load(std::memory_order_relaxed);
+			slot* s;
+			while (true) {
+				s = &slots[pos & mask];
+				auto seq = s->seq.load(std::memory_order_acquire);
+				auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+				} else if (diff < 0) {
+					// Consumer is a whole ring behind
+					dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				} else
+					pos = head.load(std::memory_order_relaxed);
+			}
+			s->lvl = l;
+			try {
+				s->msg.assign(msg);
+			} catch (const std::bad_alloc&) {
+				s->msg.clear();
+			}
+			s->seq.store(pos + 1, std::memory_order_release);
+			// Pairs with the fence in run(), either the consumer sees the slot or we see it sleeping
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (sleeping.load(std::memory_order_relaxed)) {
+				// Under the lock, so the notification can't fall between the consumers check and its wait
+				std::lock_guard<std::mutex> lck{lock};
+				wakeup.notify_one();
+			}
+		}
+
+		bool readable() const noexcept { return slots[tail & mask].seq.load(std::memory_order_acquire) == tail + 1; }
+
+		bool pop() {
+			auto& s = slots[tail & mask];
+			if (s.seq.load(std::memory_order_acquire) != tail + 1) return false;
+			sink.log(s.lvl, s.msg);
+			s.msg.clear();
+			s.seq.store(tail + mask + 1, std::memory_order_release);
+			tail++;
+			return true;
+		}
+
+		void run() {
+			while (true) {
+				if (pop()) continue;
+				if (stop.load(std::memory_order_acquire)) {
+					while (pop()) {
+					}
+					return;
+				}
+				// Producers only notify while we sleep, check again once they can see that
+				std::unique_lock<std::mutex> lck{lock};
+				sleeping.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!readable() && !stop.load(std::memory_order_acquire)) wakeup.wait(lck);
+				sleeping.store(false, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	async_logger::async_logger(const logger& sink, size_t capacity)
+		: m_state{std::make_unique<state>(sink, capacity)} {
+		m_state->thread = std::thread{&state::run, m_state.get()};
+	}
+
+	async_logger::~async_logger() {
+		{
+			std::lock_guard<std::mutex> lck{m_state->lock};
+			m_state->stop.store(true, std::memory_order_release);
+		}
+		m_state->wakeup.notify_one();
+		m_state->thread.join();
+	}
+
+	bool async_logger::should_log(level l) const noexcept {
+		return m_state->sink.should_log(l);
+	}
+
+	void async_logger::log(level l, const std::string& msg) const noexcept {
+		if (!should_log(l)) return;
+		m_state->push(l, msg);
+	}
+
+	size_t async_logger::dropped() const noexcept {
+		return m_state->dropped.load(std::memory_order_relaxed);
+	}
+
+} // namespace docker_plugin
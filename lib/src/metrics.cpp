@@ -0,0 +1,100 @@
+#include "metrics.h"
+#include "docker-plugin-cpp/plugin.h"
+#include <cstdio>
+
+namespace docker_plugin {
+	size_t latency_histogram::bucket_of(uint64_t ns) noexcept {
+		constexpr uint64_t sub_buckets = 1 << sub_bucket_bits;
+		if (ns < sub_buckets) return ns;
+		size_t exponent = 63 - __builtin_clzll(ns);
+		auto sub = (ns >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+		return ((exponent - sub_bucket_bits + 1) << sub_bucket_bits) + sub;
+	}
+
+	void latency_histogram::record(uint64_t ns) noexcept {
+		m_buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_sum.fetch_add(ns, std::memory_order_relaxed);
+	}
+
+	uint64_t latency_histogram::count_below(size_t exponent) const noexcept {
+		if (exponent >= 64) return count();
+		auto end = bucket_of(uint64_t{1} << exponent);
+		uint64_t res = 0;
+		for (size_t i = 0; i < end; i++)
+			res += m_buckets[i].load(std::memory_order_relaxed);
+		return res;
+	}
+
+	plugin_metrics::route_metrics& plugin_metrics::route(std::string_view path) {
+		auto it = m_routes.find(path);
+		if (it == m_routes.end()) it = m_routes.emplace(std::string{path}, std::make_unique<route_metrics>()).first;
+		return *it->second;
+	}
+
+	void plugin_metrics::count_response(int status) noexcept {
+		if (status >= 0 && status < max_status) m_status[status].fetch_add(1, std::memory_order_relaxed);
+		if (status >= 400) m_errors.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	namespace {
+		// Bucket bounds exported for histograms, 2^10ns (~1us) up to 2^35ns (~34s)
+		constexpr size_t first_exponent = 10;
+		constexpr size_t last_exponent = 35;
+
+		void append_counter(std::string& out, const char* name, const char* help, uint64_t value) {
+			char buf[256];
+			snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, static_cast<unsigned long long>(value));
+			out += buf;
+		}
+
+		void append_gauge(std::string& out, const char* name, const char* help, uint64_t value) {
+			char buf[256];
+			snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name, static_cast<unsigned long long>(value));
+			out += buf;
+		}
+	} // namespace
+
+	void plugin_metrics::format(std::string& out, const load_shedding_stats& shedding) const {
+		static constexpr const char* phase_names[] = {"parse", "handler", "write"};
+		char buf[256];
+		out += "# HELP dpcpp_request_phase_seconds Time spent per request phase: parse (receiving and decoding), handler (driver call), write (serializing and queueing the response)\n";
+		out += "# TYPE dpcpp_request_phase_seconds histogram\n";
+		for (auto& route : m_routes) {
+			for (size_t p = 0; p < phase_count; p++) {
+				auto& h = route.second->phases[p];
+				for (auto e = first_exponent; e <= last_exponent; e++) {
+					snprintf(buf, sizeof(buf), "dpcpp_request_phase_seconds_bucket{route=\"%s\",phase=\"%s\",le=\"%g\"} %llu\n", route.first.c_str(), phase_names[p],
+							 static_cast<double>(uint64_t{1} << e) * 1e-9, static_cast<unsigned long long>(h.count_below(e)));
+					out += buf;
+				}
+				snprintf(buf, sizeof(buf), "dpcpp_request_phase_seconds_bucket{route=\"%s\",phase=\"%s\",le=\"+Inf\"} %llu\n", route.first.c_str(), phase_names[p],
+						 static_cast<unsigned long long>(h.count()));
+				out += buf;
+				snprintf(buf, sizeof(buf), "dpcpp_request_phase_seconds_sum{route=\"%s\",phase=\"%s\"} %.9f\n", route.first.c_str(), phase_names[p],
+						 static_cast<double>(h.sum()) * 1e-9);
+				out += buf;
+				snprintf(buf, sizeof(buf), "dpcpp_request_phase_seconds_count{route=\"%s\",phase=\"%s\"} %llu\n", route.first.c_str(), phase_names[p],
+						 static_cast<unsigned long long>(h.count()));
+				out += buf;
+			}
+		}
+		out += "# HELP dpcpp_responses_total Responses sent by http status\n# TYPE dpcpp_responses_total counter\n";
+		for (int i = 0; i < max_status; i++) {
+			auto n = m_status[i].load(std::memory_order_relaxed);
+			if (n == 0) continue;
+			snprintf(buf, sizeof(buf), "dpcpp_responses_total{status=\"%d\"} %llu\n", i, static_cast<unsigned long long>(n));
+			out += buf;
+		}
+		append_counter(out, "dpcpp_errors_total", "Responses with a status of 400 or above", m_errors.load(std::memory_order_relaxed));
+		append_counter(out, "dpcpp_connections_opened_total", "Accepted plugin connections", connections_opened.load(std::memory_order_relaxed));
+		append_counter(out, "dpcpp_connections_closed_total", "Closed plugin connections", connections_closed.load(std::memory_order_relaxed));
+		append_counter(out, "dpcpp_received_bytes_total", "Bytes received on plugin connections", bytes_received.load(std::memory_order_relaxed));
+		append_counter(out, "dpcpp_sent_bytes_total", "Response bytes sent on plugin connections", bytes_sent.load(std::memory_order_relaxed));
+		append_counter(out, "dpcpp_rejected_connections_total", "Connections closed because of the connection limit", shedding.rejected_connections);
+		append_counter(out, "dpcpp_rejected_requests_total", "Requests answered with 429 because the pending queue was full", shedding.rejected_requests);
+		append_counter(out, "dpcpp_queued_requests_total", "Requests that waited for a free inflight slot", shedding.queued_requests);
+		append_gauge(out, "dpcpp_inflight_requests", "Requests currently handed to a driver", shedding.inflight_requests);
+		append_gauge(out, "dpcpp_pending_requests", "Requests currently waiting for an inflight slot", shedding.pending_requests);
+	}
+} // namespace docker_plugin
@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace docker_plugin {
+	struct load_shedding_stats;
+
+	/**
+	 * \brief Log linear latency histogram in the spirit of HdrHistogram.
+	 *
+	 * Every power of two nanoseconds is split into four buckets, which keeps the
+	 * relative error below 25% over the whole range with a fixed 2KiB of counters.
+	 * Recording is a single relaxed atomic increment per counter.
+	 */
+	class latency_histogram {
+		static constexpr size_t sub_bucket_bits = 2;
+		static constexpr size_t bucket_count = 64 << sub_bucket_bits;
+
+		std::atomic<uint64_t> m_buckets[bucket_count]{};
+		std::atomic<uint64_t> m_count{0};
+		std::atomic<uint64_t> m_sum{0};
+
+		static size_t bucket_of(uint64_t ns) noexcept;
+
+	public:
+		void record(uint64_t ns) noexcept;
+
+		/**
+		 * \brief Number of samples below 2^exponent nanoseconds.
+		 */
+		uint64_t count_below(size_t exponent) const noexcept;
+		uint64_t count() const noexcept { return m_count.load(std::memory_order_relaxed); }
+		uint64_t sum() const noexcept { return m_sum.load(std::memory_order_relaxed); }
+	};
+
+	/**
+	 * \brief Request statistics of a plugin, exported in prometheus text format.
+	 *
+	 * Routes are only added from the event loop, all counters are atomics and
+	 * can be updated from any thread.
+	 */
+	class plugin_metrics {
+	public:
+		enum phase {
+			// Receiving the request until the request struct is decoded
+			parse,
+			// Driver call
+			handler,
+			// Serializing the response and handing it to the connection
+			write,
+			phase_count
+		};
+
+		struct route_metrics {
+			latency_histogram phases[phase_count]{};
+		};
+
+		std::atomic<uint64_t> connections_opened{0};
+		std::atomic<uint64_t> connections_closed{0};
+		std::atomic<uint64_t> bytes_received{0};
+		std::atomic<uint64_t> bytes_sent{0};
+
+		/**
+		 * \brief Get the statistics for route, creating them if needed. Event loop only.
+		 */
+		route_metrics& route(std::string_view path);
+		void count_response(int status) noexcept;
+		void format(std::string& out, const load_shedding_stats& shedding) const;
+
+	private:
+		static constexpr int max_status = 600;
+
+		std::map<std::string, std::unique_ptr<route_metrics>, std::less<>> m_routes{};
+		std::atomic<uint64_t> m_status[max_status]{};
+		std::atomic<uint64_t> m_errors{0};
+	};
+} // namespace docker_plugin
@@ -3,148 +3,786 @@
 #include "docker-plugin-cpp/logger.h"
 #include "docker-plugin-cpp/network/api.h"
 #include "docker-plugin-cpp/volume/api.h"
+#include "executor.h"
 #include "http_server.h"
+#include "metrics.h"
 #include "serialize.h"
+#include "trace_log.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <csignal>
 #include <cstring>
 #include <iostream>
+#include <optional>
+#include <string_view>
+#include <thread>
 
 namespace docker_plugin {
+	namespace {
+		constexpr uint32_t route_hash(std::string_view str) noexcept {
+			// FNV-1a
+			uint32_t hash = 2166136261u;
+			for (auto c : str)
+				hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+			return hash;
+		}
+
+		template <size_t N>
+		struct rank : rank<N - 1> {};
+		template <>
+		struct rank<0> {};
+
+		// Executor key of a resource, empty ones impose no order
+		uint64_t strand_key(size_t hash, bool empty) noexcept {
+			if (empty) return 0;
+			return hash == 0 ? 1 : hash;
+		}
+		uint64_t strand_key(const docker_id& id) noexcept { return strand_key(id.hash(), id.empty()); }
+		uint64_t strand_key(const std::string& name) noexcept { return strand_key(std::hash<std::string>{}(name), name.empty()); }
+
+		// Resource a request refers to, calls for the same resource are kept in order. Endpoint
+		// calls use their network, so they stay ordered against creating and deleting it.
+		template <typename T>
+		auto ordering_key(const T& req, rank<2>) -> decltype(strand_key(req.network_id)) {
+			return strand_key(req.network_id);
+		}
+		template <typename T>
+		auto ordering_key(const T& req, rank<1>) -> decltype(strand_key(req.pool_id)) {
+			return strand_key(req.pool_id);
+		}
+		template <typename T>
+		auto ordering_key(const T& req, rank<0>) -> decltype(strand_key(req.name)) {
+			return strand_key(req.name);
+		}
+		template <typename T>
+		uint64_t ordering_key(const T&, ...) {
+			return 0;
+		}
+
+		/**
+		 * \brief Request decoded on this thread before, the next request of the same type is decoded into it.
+		 *
+		 * Requests handed to drivers on the event loop are only used while the driver call runs, so
+		 * one object per type is enough. Its strings and containers keep their memory, after the first
+		 * few calls decoding a request no longer allocates.
+		 */
+		template <typename T>
+		T& request_slot() {
+			thread_local T slot{};
+			return slot;
+		}
+
+		// Requests decoded from larger bodies are not kept, one huge request would pin its memory for good
+		constexpr size_t max_retained_body = 64 * 1024;
+
+		/**
+		 * \brief Called once the driver is done with the request in request_slot(), which is
+		 * replaced by an empty one if it was decoded from a body larger than max_retained_body.
+		 */
+		template <typename T>
+		void trim_request_slot(size_t body_size) {
+			if (body_size > max_retained_body) request_slot<T>() = T{};
+		}
+
+		// Body returned by a custom endpoint, sent as is
+		struct raw_json {
+			std::string body;
+		};
+
+		template <typename T>
+		struct route {
+			std::string_view path;
+			T handler;
+		};
+
+		/**
+		 * \brief Open addressing hash table over a fixed set of routes, built at compile time.
+		 *
+		 * The table has at least four slots per route, so nearly every lookup is a
+		 * single hash and one string compare.
+		 */
+		template <typename T, size_t N>
+		class route_table {
+			static constexpr size_t slot_count = [] {
+				size_t res = 1;
+				while (res < N * 4)
+					res <<= 1;
+				return res;
+			}();
+
+			const route<T>* m_routes;
+			// Index into m_routes plus one, zero marks an empty slot
+			std::array<uint8_t, slot_count> m_slots;
+
+		public:
+			constexpr route_table(const route<T> (&routes)[N])
+				: m_routes{routes}, m_slots{} {
+				static_assert(N < 255, "Too many routes");
+				for (size_t i = 0; i < N; i++) {
+					auto slot = route_hash(routes[i].path) & (slot_count - 1);
+					while (m_slots[slot] != 0) {
+						if (routes[m_slots[slot] - 1].path == routes[i].path) throw std::logic_error("duplicate route");
+						slot = (slot + 1) & (slot_count - 1);
+					}
+					m_slots[slot] = static_cast<uint8_t>(i + 1);
+				}
+			}
+
+			constexpr T find(std::string_view path) const noexcept {
+				auto slot = route_hash(path) & (slot_count - 1);
+				while (m_slots[slot] != 0) {
+					auto& r = m_routes[m_slots[slot] - 1];
+					if (r.path == path) return r.handler;
+					slot = (slot + 1) & (slot_count - 1);
+				}
+				return T{};
+			}
+		};
+	} // namespace
+
+	template <>
+	void to_json<raw_json>(std::string& out, const raw_json& e) {
+		out += e.body;
+	}
+
+	/**
+	 * \brief Shared state of the completion tokens for a single request.
+	 */
+	class async_response {
+		async_response(const async_response&) = delete;
+		async_response& operator=(const async_response&) = delete;
+
+		connection_handle m_handle;
+		plugin_http_connection* m_con;
+		// Thread currently running the driver call that received the token
+		std::atomic<std::thread::id> m_inline{};
+		std::atomic<bool> m_done{false};
+		// Deadline passed or client gone, the result is dropped
+		std::atomic<bool> m_cancelled{false};
+		// Admission slot taken over from the connection, returned once the driver let go of every token
+		plugin* m_slot{nullptr};
+
+	public:
+		async_response(connection_handle handle, plugin_http_connection* con)
+			: m_handle{std::move(handle)}, m_con{con} {}
+		~async_response();
+
+		void hold_slot(plugin* p) noexcept { m_slot = p; }
+
+		void begin_inline() noexcept { m_inline.store(std::this_thread::get_id(), std::memory_order_relaxed); }
+		void end_inline() noexcept { m_inline.store(std::thread::id{}, std::memory_order_relaxed); }
+		bool done() const noexcept { return m_done.load(std::memory_order_acquire); }
+		bool cancelled() const noexcept { return m_cancelled.load(std::memory_order_acquire); }
+		void cancel() noexcept { m_cancelled.store(true, std::memory_order_release); }
+		/**
+		 * \brief Cancel the request unless it was completed already.
+		 * \return true if the caller is responsible for answering the request
+		 */
+		bool expire() noexcept {
+			if (m_done.exchange(true, std::memory_order_acq_rel)) return false;
+			cancel();
+			return true;
+		}
+		void complete(int status, std::string body);
+		void post(std::function<void()> fn) const { m_handle.post_unbound(std::move(fn)); }
+	};
+
 	class plugin_http_connection : public http_connection {
 		plugin_http_connection(const plugin_http_connection&) = delete;
 		plugin_http_connection& operator=(const plugin_http_connection&) = delete;
 		plugin_http_connection(plugin_http_connection&& other) = delete;
 		plugin_http_connection& operator=(plugin_http_connection&& other) = delete;
 
+		using route_handler = void (*)(plugin_http_connection&);
+		friend class async_response;
+
 		plugin* m_plugin;
 		std::string m_url;
+		route_handler m_route;
+		const plugin::endpoint_handler* m_endpoint;
+		// Only maintained while tracing
+		std::chrono::steady_clock::time_point m_handler_start{};
+		uint32_t m_request_size{0};
+		// Only maintained while collecting metrics, null for requests without a route
+		plugin_metrics::route_metrics* m_stats{nullptr};
+		std::chrono::steady_clock::time_point m_begin{};
+		std::chrono::steady_clock::time_point m_parsed{};
+		std::chrono::steady_clock::time_point m_handled{};
+		// Deadline of the current request, zero if unlimited
+		std::chrono::milliseconds m_deadline{0};
+		timer m_deadline_timer{};
+		std::weak_ptr<async_response> m_pending{};
+		// Holds one of the inflight slots, or waits for one in the pending queue
+		bool m_admitted{false};
+		bool m_queued{false};
+		// Streamed VolumeDriver.List response, null unless one is being written
+		std::unique_ptr<volume::volume_cursor> m_list{};
+		volume::volume_info m_list_entry{};
+		std::string m_list_buffer{};
+		bool m_list_first{true};
+		// Part of the response was sent, errors can't be reported anymore
+		bool m_list_sent{false};
 
-		template <typename TObject, typename TRequest, typename TResponse>
-		void invoke_plugin_handler(TResponse (TObject::*fn)(const TRequest&), TObject* obj) {
+		// Streamed volumes are sent in chunks of about this size
+		static constexpr size_t list_chunk_size = 32 * 1024;
+		// Bytes produced per turn of the event loop, so a long list doesn't hold up other connections
+		static constexpr size_t list_batch_limit = 256 * 1024;
+
+		void mark(std::chrono::steady_clock::time_point& point) noexcept {
+			if (m_stats) point = std::chrono::steady_clock::now();
+		}
+
+		std::string* cache_slot() {
+			if (m_plugin->m_response_cache.empty()) return nullptr;
+			auto it = m_plugin->m_response_cache.find(m_url);
+			return it == m_plugin->m_response_cache.end() ? nullptr : &it->second;
+		}
+
+		void end_cached(std::string& slot, int status, const std::string& body) {
+			http_header_set headers;
+			headers.set("content-type", "application/vnd.docker.plugins.v1.1+json");
+			slot = prepare_response(status, std::move(headers), body);
+			end_prepared(slot);
+		}
+
+		template <typename T>
+		void send_json(int status, const T& value) {
+			if (status == 200) {
+				if (auto slot = cache_slot()) return end_cached(*slot, status, to_json<T>(value));
+			}
 			response_headers().set("content-type", "application/vnd.docker.plugins.v1.1+json");
-			if (!obj) {
+			response_status(status);
+			to_json<T>(begin_body(), value);
+			end_body();
+		}
+
+		void send_serialized(int status, const std::string& body) {
+			mark(m_handled);
+			m_deadline_timer.cancel();
+			m_pending.reset();
+			if (status == 200) {
+				if (auto slot = cache_slot()) return end_cached(*slot, status, body);
+			}
+			response_headers().set("content-type", "application/vnd.docker.plugins.v1.1+json");
+			response_status(status);
+			begin_body() += body;
+			end_body();
+		}
+
+		// Take a slot for the current request, queue it or turn it away if there is none
+		bool admit() {
+			auto p = m_plugin;
+			if (p->m_max_inflight == 0) return true;
+			if (p->m_inflight < p->m_max_inflight) {
+				p->m_inflight++;
+				m_admitted = true;
+				return true;
+			}
+			if (p->m_pending.size() < p->m_max_pending) {
+				p->m_pending.push_back(this);
+				p->m_queued_requests++;
+				m_queued = true;
+				defer_response();
+				return false;
+			}
+			p->m_rejected_requests++;
+			end_prepared(p->m_reject_response);
+			return false;
+		}
+
+		// Give the slot of the current request to the next queued one
+		void release() {
+			if (!m_admitted) return;
+			m_admitted = false;
+			release_slot(m_plugin);
+		}
+
+		// Drivers answering later keep the slot until their call returned, not just until the response was sent
+		void hand_over_slot(async_response& res) noexcept {
+			if (!m_admitted) return;
+			m_admitted = false;
+			res.hold_slot(m_plugin);
+		}
+
+		static void release_slot(plugin* p) {
+			p->m_inflight--;
+			if (p->m_pending.empty()) return;
+			auto next = p->m_pending.front();
+			p->m_pending.pop_front();
+			next->m_queued = false;
+			next->m_admitted = true;
+			p->m_inflight++;
+			// Not from within this connections response, a closed connection returns the slot in on_disconnect
+			next->handle().post([next]() { next->dispatch(); });
+		}
+
+		void dispatch() {
+			if (m_endpoint != nullptr) {
+				this->invoke_handler<raw_json>([this]() { return raw_json{(*m_endpoint)(body())}; });
+			} else if (m_route != nullptr) {
+				m_route(*this);
+			} else {
+				// TODO: Handle Message
 				response_status(404);
-				return end("Not found");
+				end("Not found");
+			}
+		}
+
+		void begin_list(std::unique_ptr<volume::volume_cursor> cursor) {
+			m_list = std::move(cursor);
+			m_list_first = true;
+			m_list_sent = false;
+			m_list_buffer = "{\"Volumes\":[";
+			defer_response();
+			response_headers().set("content-type", "application/vnd.docker.plugins.v1.1+json");
+			response_status(200);
+			continue_list();
+		}
+
+		// Write the next batch of volumes, continued once the socket drained or on the next turn of the event loop
+		void continue_list() {
+			size_t produced = 0;
+			while (!write_blocked() && produced < list_batch_limit) {
+				auto& e = m_list_entry;
+				e.name.clear();
+				e.mountpoint.clear();
+				e.created_at = {};
+				e.status.clear();
+				bool more = false;
+				error_response error;
+				if (!try_invoke([&]() { more = m_list->next(e); }, error)) {
+					m_list.reset();
+					m_list_buffer.clear();
+					if (!m_list_sent) {
+						mark(m_handled);
+						return send_json(error.status, error);
+					}
+					// The status went out with the first chunk, all that is left is cutting the response short
+					if (m_plugin->m_logger && m_plugin->m_logger->should_log(logger::level::error)) m_plugin->m_logger->log(logger::level::error, "Listing volumes failed: " + error.error);
+					return close();
+				}
+				if (!more) return end_list();
+				if (!m_list_first) m_list_buffer += ',';
+				m_list_first = false;
+				to_json(m_list_buffer, e);
+				if (m_list_buffer.size() >= list_chunk_size) {
+					produced += m_list_buffer.size();
+					flush_list();
+				}
 			}
-			std::string response;
+			if (!m_list_buffer.empty()) flush_list();
+			// Otherwise on_drain() picks up again
+			if (!write_blocked()) handle().post([this]() {
+				if (m_list) continue_list();
+			});
+		}
+
+		void flush_list() {
+			send_data(m_list_buffer);
+			m_list_buffer.clear();
+			m_list_sent = true;
+		}
+
+		void end_list() {
+			m_list.reset();
+			m_list_buffer += "]}";
+			flush_list();
+			mark(m_handled);
+			end();
+		}
+
+		// Called once a request was handed to a driver that answers later
+		void watch(const std::shared_ptr<async_response>& res) {
+			if (res->done()) return;
+			m_pending = res;
+			if (m_deadline.count() > 0) schedule(m_deadline_timer, m_deadline, [this]() { on_deadline(); });
+		}
+
+		void on_deadline() {
+			auto res = m_pending.lock();
+			m_pending.reset();
+			// Answered in the meantime, or every token was dropped which answers as well
+			if (!res || !res->expire()) return;
+			if (m_plugin->m_logger && m_plugin->m_logger->should_log(logger::level::warning)) m_plugin->m_logger->log(logger::level::warning, "Deadline exceeded for '" + m_url + "'");
+			send_json(504, error_response{504, "deadline exceeded"});
+		}
+
+		template <typename TFn>
+		static bool try_invoke(TFn&& fn, error_response& error) {
 			try {
-				auto req = from_json<TRequest>(body());
-				auto res = (obj->*fn)(req);
-				response_status(200);
-				response = to_json<TResponse>(res);
+				fn();
+				return true;
 			} catch (const error_response& e) {
-				response_status(e.status);
-				response = to_json<error_response>(e);
+				error = e;
 			} catch (const std::invalid_argument& e) {
-				response_status(400);
-				response = to_json<error_response>({0, e.what()});
+				error = {400, e.what()};
 			} catch (const std::exception& e) {
-				response_status(500);
-				response = to_json<error_response>({0, e.what()});
+				error = {500, e.what()};
+			}
+			return false;
+		}
+
+		template <typename TResponse, typename TFn>
+		void invoke_handler(TFn&& fn) {
+			std::optional<TResponse> response;
+			error_response error;
+			auto ok = try_invoke([&]() { response.emplace(fn()); }, error);
+			mark(m_handled);
+			if (ok) return send_json(200, *response);
+			send_json(error.status, error);
+		}
+
+		template <typename TObject, typename TRequest, typename TResponse>
+		void invoke_async_handler(void (TObject::*fn)(const TRequest&, completion<TResponse>), TObject* obj) {
+			// Parsing stops until the response is there, so body() and m_url stay valid
+			defer_response();
+			auto res = std::make_shared<async_response>(handle(), this);
+			hand_over_slot(*res);
+			// The body is gone once the response was sent
+			auto body_size = body().size();
+			res->begin_inline();
+			error_response error;
+			if (!try_invoke(
+					[&]() {
+						auto& req = request_slot<TRequest>();
+						from_json<TRequest>(body(), req);
+						mark(m_parsed);
+						(obj->*fn)(req, completion<TResponse>{res, &to_json<TResponse>});
+					},
+					error))
+				res->complete(error.status, to_json(error));
+			res->end_inline();
+			trim_request_slot<TRequest>(body_size);
+			watch(res);
+		}
+
+		template <typename TObject, typename TRequest, typename TResponse>
+		void invoke_plugin_handler(TResponse (TObject::*fn)(const TRequest&), TObject* obj) {
+			if (!obj) {
+				response_headers().set("content-type", "application/vnd.docker.plugins.v1.1+json");
+				response_status(404);
+				return end("Not found");
 			}
-			return end(response);
+			auto body_size = body().size();
+			invoke_handler<TResponse>([&]() {
+				auto& req = request_slot<TRequest>();
+				from_json<TRequest>(body(), req);
+				mark(m_parsed);
+				return (obj->*fn)(req);
+			});
+			trim_request_slot<TRequest>(body_size);
+		}
+
+		template <typename TObject, typename TRequest, typename TResponse>
+		void invoke_on_executor(TResponse (TObject::*fn)(const TRequest&), TObject* obj) {
+			// Parsed here, the body is owned by the event loop
+			std::optional<TRequest> req;
+			error_response error;
+			if (!try_invoke([&]() { req.emplace(from_json<TRequest>(body())); }, error)) return send_json(error.status, error);
+			mark(m_parsed);
+			defer_response();
+			auto key = ordering_key(*req, rank<2>{});
+			auto state = std::make_shared<async_response>(handle(), this);
+			hand_over_slot(*state);
+			watch(state);
+			completion<TResponse> res{std::move(state), &to_json<TResponse>};
+			m_plugin->m_executor->post(key, [fn, obj, req = std::move(*req), res]() {
+				// Given up on while queued
+				if (res.cancelled()) return;
+				error_response error;
+				if (!try_invoke([&]() { res((obj->*fn)(req)); }, error)) res.fail(error);
+			});
+		}
+
+		template <auto Fn, auto AsyncFn, auto Driver, auto AsyncDriver>
+		static void driver_route(plugin_http_connection& con) {
+			if (auto drv = con.m_plugin->*AsyncDriver) return con.invoke_async_handler(AsyncFn, drv);
+			if (con.m_plugin->m_executor && con.m_plugin->*Driver) return con.invoke_on_executor(Fn, con.m_plugin->*Driver);
+			con.invoke_plugin_handler(Fn, con.m_plugin->*Driver);
+		}
+
+		template <auto Fn, auto AsyncFn>
+		static void volume_route(plugin_http_connection& con) {
+			driver_route<Fn, AsyncFn, &plugin::m_volume_driver, &plugin::m_volume_async>(con);
+		}
+
+		static void list_route(plugin_http_connection& con) {
+			auto p = con.m_plugin;
+			std::unique_ptr<volume::volume_cursor> cursor;
+			error_response error;
+			if (!try_invoke(
+					[&]() {
+						if (p->m_volume_async)
+							cursor = p->m_volume_async->list_volumes(empty_type{});
+						else if (p->m_volume_driver)
+							cursor = p->m_volume_driver->list_volumes(empty_type{});
+					},
+					error)) {
+				con.mark(con.m_handled);
+				return con.send_json(error.status, error);
+			}
+			if (!cursor) return volume_route<&volume::driver::list, &volume::async_driver::list>(con);
+			con.begin_list(std::move(cursor));
+		}
+
+		template <auto Fn, auto AsyncFn>
+		static void network_route(plugin_http_connection& con) {
+			driver_route<Fn, AsyncFn, &plugin::m_network_driver, &plugin::m_network_async>(con);
+		}
+
+		template <auto Fn, auto AsyncFn>
+		static void ipam_route(plugin_http_connection& con) {
+			driver_route<Fn, AsyncFn, &plugin::m_ipam_driver, &plugin::m_ipam_async>(con);
+		}
+
+		static route_handler find_route(std::string_view url) noexcept {
+			static constexpr route<route_handler> routes[] = {
+				{"/Plugin.Activate", [](plugin_http_connection& con) { con.invoke_plugin_handler(&plugin_http_connection::plugin_activate, &con); }},
+				{"/VolumeDriver.Create", &volume_route<&volume::driver::create, &volume::async_driver::create>},
+				{"/VolumeDriver.Remove", &volume_route<&volume::driver::remove, &volume::async_driver::remove>},
+				{"/VolumeDriver.Mount", &volume_route<&volume::driver::mount, &volume::async_driver::mount>},
+				{"/VolumeDriver.Path", &volume_route<&volume::driver::path, &volume::async_driver::path>},
+				{"/VolumeDriver.Unmount", &volume_route<&volume::driver::unmount, &volume::async_driver::unmount>},
+				{"/VolumeDriver.Get", &volume_route<&volume::driver::get, &volume::async_driver::get>},
+				{"/VolumeDriver.List", &list_route},
+				{"/VolumeDriver.Capabilities", &volume_route<&volume::driver::capabilities, &volume::async_driver::capabilities>},
+				{"/NetworkDriver.GetCapabilities", &network_route<&network::driver::capabilities, &network::async_driver::capabilities>},
+				{"/NetworkDriver.CreateNetwork", &network_route<&network::driver::create_network, &network::async_driver::create_network>},
+				{"/NetworkDriver.AllocateNetwork", &network_route<&network::driver::allocate_network, &network::async_driver::allocate_network>},
+				{"/NetworkDriver.DeleteNetwork", &network_route<&network::driver::delete_network, &network::async_driver::delete_network>},
+				{"/NetworkDriver.FreeNetwork", &network_route<&network::driver::free_network, &network::async_driver::free_network>},
+				{"/NetworkDriver.CreateEndpoint", &network_route<&network::driver::create_endpoint, &network::async_driver::create_endpoint>},
+				{"/NetworkDriver.DeleteEndpoint", &network_route<&network::driver::delete_endpoint, &network::async_driver::delete_endpoint>},
+				{"/NetworkDriver.EndpointOperInfo", &network_route<&network::driver::endpoint_info, &network::async_driver::endpoint_info>},
+				{"/NetworkDriver.Join", &network_route<&network::driver::join, &network::async_driver::join>},
+				{"/NetworkDriver.Leave", &network_route<&network::driver::leave, &network::async_driver::leave>},
+				{"/NetworkDriver.DiscoverNew", &network_route<&network::driver::discover_new, &network::async_driver::discover_new>},
+				{"/NetworkDriver.DiscoverDelete", &network_route<&network::driver::discover_delete, &network::async_driver::discover_delete>},
+				{"/NetworkDriver.ProgramExternalConnectivity", &network_route<&network::driver::program_external_connectivity, &network::async_driver::program_external_connectivity>},
+				{"/NetworkDriver.RevokeExternalConnectivity", &network_route<&network::driver::revoke_external_connectivity, &network::async_driver::revoke_external_connectivity>},
+				{"/IpamDriver.GetCapabilities", &ipam_route<&ipam::driver::capabilities, &ipam::async_driver::capabilities>},
+				{"/IpamDriver.GetDefaultAddressSpaces", &ipam_route<&ipam::driver::default_address_spaces, &ipam::async_driver::default_address_spaces>},
+				{"/IpamDriver.RequestPool", &ipam_route<&ipam::driver::request_pool, &ipam::async_driver::request_pool>},
+				{"/IpamDriver.ReleasePool", &ipam_route<&ipam::driver::release_pool, &ipam::async_driver::release_pool>},
+				{"/IpamDriver.RequestAddress", &ipam_route<&ipam::driver::request_address, &ipam::async_driver::request_address>},
+				{"/IpamDriver.ReleaseAddress", &ipam_route<&ipam::driver::release_address, &ipam::async_driver::release_address>},
+			};
+			static constexpr route_table<route_handler, std::size(routes)> table{routes};
+			return table.find(url);
 		}
 
 		activate_response plugin_activate(const empty_type&) {
 			activate_response resp;
-			if (m_plugin->m_volume_driver != nullptr) resp.implements.insert("VolumeDriver");
-			if (m_plugin->m_network_driver != nullptr) resp.implements.insert("NetworkDriver");
-			if (m_plugin->m_ipam_driver != nullptr) resp.implements.insert("IpamDriver");
+			if (m_plugin->m_volume_driver != nullptr || m_plugin->m_volume_async != nullptr) resp.implements.insert("VolumeDriver");
+			if (m_plugin->m_network_driver != nullptr || m_plugin->m_network_async != nullptr) resp.implements.insert("NetworkDriver");
+			if (m_plugin->m_ipam_driver != nullptr || m_plugin->m_ipam_async != nullptr) resp.implements.insert("IpamDriver");
 			return resp;
 		}
 
 	public:
+		static std::string rejection(int status, std::chrono::seconds retry_after, const char* message, bool close) {
+			http_header_set headers;
+			headers.set("content-type", "application/vnd.docker.plugins.v1.1+json");
+			headers.set("retry-after", std::to_string(retry_after.count()));
+			if (close) headers.set("connection", "close");
+			return prepare_response(status, std::move(headers), to_json(error_response{status, message}));
+		}
+
 		plugin_http_connection(int socket, plugin* p)
-			: http_connection{socket}, m_plugin{p}, m_url{} {}
+			: http_connection{socket}, m_plugin{p}, m_url{}, m_route{nullptr}, m_endpoint{nullptr} {}
+		static void on_connect(const std::shared_ptr<plugin_http_connection>& con) {
+			if (auto m = con->m_plugin->m_metrics.get()) m->connections_opened.fetch_add(1, std::memory_order_relaxed);
+		}
+		static void on_disconnect(const std::shared_ptr<plugin_http_connection>& con) {
+			if (auto m = con->m_plugin->m_metrics.get()) m->connections_closed.fetch_add(1, std::memory_order_relaxed);
+			// Abandoned by the client, stop working on it
+			con->m_deadline_timer.cancel();
+			if (auto res = con->m_pending.lock()) res->cancel();
+			con->m_list.reset();
+			if (con->m_queued) {
+				auto& pending = con->m_plugin->m_pending;
+				pending.erase(std::find(pending.begin(), pending.end(), con.get()));
+				con->m_queued = false;
+			}
+			con->release();
+		}
+
+		bool reset() override {
+			m_url.clear();
+			m_route = nullptr;
+			m_endpoint = nullptr;
+			m_stats = nullptr;
+			m_deadline = std::chrono::milliseconds{0};
+			m_deadline_timer.cancel();
+			m_pending.reset();
+			m_admitted = false;
+			m_queued = false;
+			m_list.reset();
+			m_list_buffer.clear();
+			return http_connection::reset();
+		}
+
+		void on_drain() override {
+			if (m_list) continue_list();
+			http_connection::on_drain();
+		}
+
+		void on_read(const void* data, size_t len) override {
+			if (auto m = m_plugin->m_metrics.get()) m->bytes_received.fetch_add(len, std::memory_order_relaxed);
+			http_connection::on_read(data, len);
+		}
 		int on_message_begin() noexcept override {
-			buffer_headers();
 			buffer_body();
+			if (m_plugin->m_metrics) m_begin = std::chrono::steady_clock::now();
 			return 0;
 		}
 		int on_url(llhttp_method method, const std::string& url) noexcept override {
+			m_stats = nullptr;
 			if (method != HTTP_POST) {
-				if (m_plugin->m_logger) m_plugin->m_logger->log(logger::level::warning, "Get a non post request for '" + url + "'");
+				if (m_plugin->m_trace) {
+					m_url = url;
+					m_handler_start = std::chrono::steady_clock::now();
+					m_request_size = 0;
+				}
+				if (m_plugin->m_logger && m_plugin->m_logger->should_log(logger::level::warning)) m_plugin->m_logger->log(logger::level::warning, "Get a non post request for '" + url + "'");
 				response_status(405);
 				end("Method not allowed");
 				return 1;
 			}
 			m_url = url;
+			m_endpoint = nullptr;
+			if (!m_plugin->m_endpoints.empty()) {
+				auto it = m_plugin->m_endpoints.find(url);
+				if (it != m_plugin->m_endpoints.end()) m_endpoint = &it->second;
+			}
+			m_route = m_endpoint == nullptr ? find_route(url) : nullptr;
+			m_deadline = std::chrono::milliseconds{0};
+			if (!m_plugin->m_deadlines.empty()) {
+				auto it = m_plugin->m_deadlines.find(url);
+				if (it != m_plugin->m_deadlines.end()) m_deadline = it->second;
+			}
+			// Unknown paths share a single entry, clients can't grow the table
+			if (m_plugin->m_metrics) m_stats = &m_plugin->m_metrics->route(m_endpoint != nullptr || m_route != nullptr ? std::string_view{url} : "other");
 			return 0;
 		}
 		int on_message_complete() noexcept override {
-			if (m_plugin->m_logger) m_plugin->m_logger->log(logger::level::info, m_url);
-			if (m_url == "/Plugin.Activate") {
-				this->invoke_plugin_handler(&plugin_http_connection::plugin_activate, this);
-			} else if (m_url == "/VolumeDriver.Create") {
-				this->invoke_plugin_handler(&volume::driver::create, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.Remove") {
-				this->invoke_plugin_handler(&volume::driver::remove, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.Mount") {
-				this->invoke_plugin_handler(&volume::driver::mount, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.Path") {
-				this->invoke_plugin_handler(&volume::driver::path, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.Unmount") {
-				this->invoke_plugin_handler(&volume::driver::unmount, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.Get") {
-				this->invoke_plugin_handler(&volume::driver::get, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.List") {
-				this->invoke_plugin_handler(&volume::driver::list, m_plugin->m_volume_driver);
-			} else if (m_url == "/VolumeDriver.Capabilities") {
-				this->invoke_plugin_handler(&volume::driver::capabilities, m_plugin->m_volume_driver);
-			} else if (m_url == "/NetworkDriver.GetCapabilities") {
-				this->invoke_plugin_handler(&network::driver::capabilities, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.CreateNetwork") {
-				this->invoke_plugin_handler(&network::driver::create_network, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.AllocateNetwork") {
-				this->invoke_plugin_handler(&network::driver::allocate_network, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.DeleteNetwork") {
-				this->invoke_plugin_handler(&network::driver::delete_network, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.FreeNetwork") {
-				this->invoke_plugin_handler(&network::driver::free_network, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.CreateEndpoint") {
-				this->invoke_plugin_handler(&network::driver::create_endpoint, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.DeleteEndpoint") {
-				this->invoke_plugin_handler(&network::driver::delete_endpoint, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.EndpointOperInfo") {
-				this->invoke_plugin_handler(&network::driver::endpoint_info, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.Join") {
-				this->invoke_plugin_handler(&network::driver::join, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.Leave") {
-				this->invoke_plugin_handler(&network::driver::leave, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.DiscoverNew") {
-				this->invoke_plugin_handler(&network::driver::discover_new, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.DiscoverDelete") {
-				this->invoke_plugin_handler(&network::driver::discover_delete, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.ProgramExternalConnectivity") {
-				this->invoke_plugin_handler(&network::driver::program_external_connectivity, m_plugin->m_network_driver);
-			} else if (m_url == "/NetworkDriver.RevokeExternalConnectivity") {
-				this->invoke_plugin_handler(&network::driver::revoke_external_connectivity, m_plugin->m_network_driver);
-			} else if (m_url == "/IpamDriver.GetCapabilities") {
-				this->invoke_plugin_handler(&ipam::driver::capabilities, m_plugin->m_ipam_driver);
-			} else if (m_url == "/IpamDriver.GetDefaultAddressSpaces") {
-				this->invoke_plugin_handler(&ipam::driver::default_address_spaces, m_plugin->m_ipam_driver);
-			} else if (m_url == "/IpamDriver.RequestPool") {
-				this->invoke_plugin_handler(&ipam::driver::request_pool, m_plugin->m_ipam_driver);
-			} else if (m_url == "/IpamDriver.ReleasePool") {
-				this->invoke_plugin_handler(&ipam::driver::release_pool, m_plugin->m_ipam_driver);
-			} else if (m_url == "/IpamDriver.RequestAddress") {
-				this->invoke_plugin_handler(&ipam::driver::request_address, m_plugin->m_ipam_driver);
-			} else if (m_url == "/IpamDriver.ReleaseAddress") {
-				this->invoke_plugin_handler(&ipam::driver::release_address, m_plugin->m_ipam_driver);
-			} else {
-				// TODO: Handle Message
+			if (m_plugin->m_logger && m_plugin->m_logger->should_log(logger::level::info)) m_plugin->m_logger->log(logger::level::info, m_url);
+			if (m_plugin->m_trace) {
+				m_handler_start = std::chrono::steady_clock::now();
+				m_request_size = static_cast<uint32_t>(std::min<size_t>(body().size(), UINT32_MAX));
+			}
+			// Requests served without decoding count as parsed once complete
+			mark(m_parsed);
+			m_handled = m_parsed;
+			if (!m_plugin->m_response_cache.empty()) {
+				auto it = m_plugin->m_response_cache.find(m_url);
+				if (it != m_plugin->m_response_cache.end() && !it->second.empty()) {
+					end_prepared(it->second);
+					return 0;
+				}
+			}
+			if (admit()) dispatch();
+			return 0;
+		}
+		void on_response_complete(int status, size_t size) override {
+			release();
+			if (auto m = m_plugin->m_metrics.get()) {
+				m->count_response(status);
+				m->bytes_sent.fetch_add(size, std::memory_order_relaxed);
+				if (m_stats) {
+					auto now = std::chrono::steady_clock::now();
+					auto ns = [](std::chrono::steady_clock::duration d) { return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()); };
+					m_stats->phases[plugin_metrics::parse].record(ns(m_parsed - m_begin));
+					m_stats->phases[plugin_metrics::handler].record(ns(m_handled - m_parsed));
+					m_stats->phases[plugin_metrics::write].record(ns(now - m_handled));
+					m_stats = nullptr;
+				}
+			}
+			if (!m_plugin->m_trace) return;
+			auto duration = std::chrono::steady_clock::now() - m_handler_start;
+			auto now = std::chrono::system_clock::now().time_since_epoch();
+			m_plugin->m_trace->write(m_url, get_fd(), static_cast<uint16_t>(status), m_request_size, static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX)),
+									 std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+									 std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+		}
+	};
+
+	/**
+	 * \brief Serves the statistics of a plugin in prometheus text format.
+	 */
+	class metrics_http_connection : public http_connection {
+		metrics_http_connection(const metrics_http_connection&) = delete;
+		metrics_http_connection& operator=(const metrics_http_connection&) = delete;
+
+		plugin* m_plugin;
+		int m_status{404};
+
+	public:
+		metrics_http_connection(int socket, plugin* p)
+			: http_connection{socket}, m_plugin{p} {}
+		int on_url(llhttp_method method, const std::string& url) noexcept override {
+			auto path = std::string_view{url}.substr(0, url.find('?'));
+			m_status = path != "/metrics" ? 404 : (method != HTTP_GET ? 405 : 200);
+			return 0;
+		}
+		int on_message_complete() noexcept override {
+			if (m_status == 404) {
 				response_status(404);
 				end("Not found");
+			} else if (m_status == 405) {
+				response_status(405);
+				end("Method not allowed");
+			} else {
+				response_headers().set("content-type", "text/plain; version=0.0.4");
+				response_status(200);
+				m_plugin->m_metrics->format(begin_body(), m_plugin->get_shedding_stats());
+				end_body();
 			}
 			return 0;
 		}
 	};
 
-	plugin::plugin(const std::string& driver_name, logger* log)
-		: m_logger{log}, m_server{nullptr}, m_volume_driver{nullptr}, m_network_driver{nullptr}, m_ipam_driver{nullptr} {
+	async_response::~async_response() {
+		try {
+			if (!m_done.load(std::memory_order_relaxed) && !cancelled()) complete(500, to_json(error_response{500, "request dropped by driver"}));
+			// May run on a worker, and after the client is gone or got its 504
+			if (auto p = m_slot) m_handle.post_unbound([p]() { plugin_http_connection::release_slot(p); });
+		} catch (const std::exception&) {
+		}
+	}
+
+	void async_response::complete(int status, std::string body) {
+		if (m_done.exchange(true, std::memory_order_acq_rel) || cancelled()) return;
+		// Still inside the driver call, which runs on the event loop
+		if (m_inline.load(std::memory_order_relaxed) == std::this_thread::get_id()) return m_con->send_serialized(status, body);
+		auto con = m_con;
+		m_handle.post([con, status, body = std::move(body)]() { con->send_serialized(status, body); });
+	}
+
+	void completion_base::complete(int status, std::string body) const {
+		m_response->complete(status, std::move(body));
+	}
+
+	void completion_base::fail(const error_response& error) const {
+		m_response->complete(error.status, to_json(error));
+	}
+
+	bool completion_base::cancelled() const noexcept {
+		return m_response->cancelled();
+	}
+
+	void completion_base::post(std::function<void()> fn) const {
+		m_response->post(std::move(fn));
+	}
+
+	plugin::plugin(const std::string& driver_name, logger* log, io_backend backend)
+		: m_logger{log}, m_server{nullptr}, m_executor{nullptr}, m_trace{nullptr}, m_metrics{nullptr}, m_volume_driver{nullptr}, m_network_driver{nullptr}, m_ipam_driver{nullptr},
+		  m_volume_async{nullptr}, m_network_async{nullptr}, m_ipam_async{nullptr}, m_endpoints{}, m_response_cache{{"/Plugin.Activate", ""}}, m_deadlines{}, m_timers{},
+		  m_next_timer{1}, m_max_inflight{0}, m_max_pending{0}, m_inflight{0}, m_pending{}, m_reject_response{}, m_rejected_requests{0}, m_queued_requests{0} {
 		// Silence the dinos
 		signal(SIGPIPE, SIG_IGN);
-		m_server = std::make_unique<http_server<plugin_http_connection, plugin*>>(m_logger, this);
+		m_server = std::make_unique<http_server<plugin_http_connection, plugin*>>(m_logger, backend, this);
 		std::error_code ec;
 		m_server->bind("/run/docker/plugins/" + driver_name + ".sock", ec);
 		if (ec) {
@@ -155,10 +793,88 @@ namespace docker_plugin {
 	}
 
 	plugin::~plugin() {
+		// Finish outstanding driver calls first, their results are dropped
+		m_executor.reset();
+		m_timers.clear();
 		m_server.reset();
 	}
 
+	void plugin::invalidate_driver(const char* prefix) noexcept {
+		auto len = strlen(prefix);
+		for (auto& e : m_response_cache) {
+			if (e.first == "/Plugin.Activate" || e.first.compare(0, len, prefix) == 0) e.second.clear();
+		}
+	}
+
+	void plugin::enable_trace(const std::string& path, size_t records) {
+		m_trace = std::make_unique<trace_log>(path, records);
+	}
+
+	void plugin::disable_trace() noexcept {
+		m_trace.reset();
+	}
+
+	void plugin::enable_metrics(const std::string& path) {
+		if (!m_metrics) m_metrics = std::make_unique<plugin_metrics>();
+		std::error_code ec;
+		m_server->bind(
+			path, [this](int socket) { return std::make_shared<metrics_http_connection>(socket, this); }, ec);
+		if (ec) {
+			if (m_logger) m_logger->log(logger::level::error, "Failed to bind metrics to " + path + ": " + ec.message());
+			throw std::system_error(ec);
+		}
+		if (m_logger) m_logger->log(logger::level::debug, "Serving metrics on uds socket " + path);
+	}
+
+	void plugin::set_worker_threads(size_t count) {
+		m_executor.reset();
+		if (count != 0) m_executor = std::make_unique<executor>(count);
+	}
+
+	void plugin::set_admission_limits(size_t max_connections, size_t max_inflight, size_t max_pending, std::chrono::seconds retry_after) {
+		m_server->set_connection_limit(max_connections, plugin_http_connection::rejection(503, retry_after, "too many connections", true));
+		m_max_inflight = max_inflight;
+		m_max_pending = max_pending;
+		m_reject_response = plugin_http_connection::rejection(429, retry_after, "too many requests", false);
+	}
+
+	load_shedding_stats plugin::get_shedding_stats() const noexcept {
+		return {m_server->rejected_connections(), m_rejected_requests, m_queued_requests, m_inflight, m_pending.size()};
+	}
+
+	void plugin::set_timeouts(std::chrono::milliseconds idle, std::chrono::milliseconds header, std::chrono::milliseconds body) noexcept {
+		m_server->set_timeouts(connection_timeouts{idle, header, body});
+	}
+
+	uint64_t plugin::start_timer(std::chrono::milliseconds delay, std::function<void()> fn) {
+		auto id = m_next_timer++;
+		auto& t = m_timers[id];
+		t = std::make_unique<timer>();
+		m_server->schedule(*t, delay, [this, id, fn = std::move(fn)]() {
+			// Done with the timer before fn runs, it may start new ones
+			m_timers.erase(id);
+			fn();
+		});
+		return id;
+	}
+
+	void plugin::cancel_timer(uint64_t id) noexcept {
+		m_timers.erase(id);
+	}
+
+	void plugin::set_write_watermarks(size_t low, size_t high) noexcept {
+		m_server->set_write_watermarks(low, high);
+	}
+
 	int plugin::run(std::chrono::milliseconds timeout) {
 		return m_server->run(timeout.count());
 	}
+
+	int plugin::get_fd() {
+		return m_server->get_fd();
+	}
+
+	int plugin::process_ready() {
+		return m_server->process_ready();
+	}
 } // namespace docker_plugin
\ No newline at end of file
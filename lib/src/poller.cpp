@@ -0,0 +1,180 @@
+#include "poller.h"
+#include "docker-plugin-cpp/plugin.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <unistd.h>
+#ifdef DPCPP_HAVE_IO_URING
+#include "uring_poller.h"
+#endif
+
+namespace docker_plugin {
+	std::unique_ptr<poller> poller::create(io_backend backend) {
+		switch (backend) {
+		case io_backend::io_uring:
+#ifdef DPCPP_HAVE_IO_URING
+			try {
+				return std::make_unique<uring_poller>();
+			} catch (const std::system_error&) {
+			}
+#endif
+			// fallthrough
+		case io_backend::epoll:
+			try {
+				return std::make_unique<epoll_poller>();
+			} catch (const std::system_error&) {
+			}
+			// fallthrough
+		case io_backend::select:
+		default: return std::make_unique<select_poller>();
+		}
+	}
+
+	size_t poller::sendv(int fd, const iovec* iov, size_t count) {
+		struct iovec local[16];
+		size_t total = 0;
+		while (count != 0) {
+			// Use a local copy that can be advanced on partial writes
+			auto n = std::min<size_t>(count, 16);
+			std::copy(iov, iov + n, local);
+			struct msghdr msg {};
+			msg.msg_iov = local;
+			msg.msg_iovlen = n;
+			size_t batch = 0;
+			for (size_t i = 0; i < n; i++)
+				batch += local[i].iov_len;
+			size_t done = 0;
+			while (done < batch) {
+				auto res = ::sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (res < 0) {
+					if (errno == EINTR) continue;
+					if (errno == EAGAIN || errno == EWOULDBLOCK) return total + done;
+					return SIZE_MAX;
+				}
+				done += res;
+				auto remaining = static_cast<size_t>(res);
+				while (msg.msg_iovlen != 0 && remaining >= msg.msg_iov->iov_len) {
+					remaining -= msg.msg_iov->iov_len;
+					msg.msg_iov++;
+					msg.msg_iovlen--;
+				}
+				if (msg.msg_iovlen != 0) {
+					msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + remaining;
+					msg.msg_iov->iov_len -= remaining;
+				}
+			}
+			total += batch;
+			iov += n;
+			count -= n;
+		}
+		return total;
+	}
+
+	size_t poller::send(int fd, const void* data, size_t len) {
+		struct iovec iov {
+			const_cast<void*>(data), len
+		};
+		return sendv(fd, &iov, 1);
+	}
+
+	int select_poller::add(int fd, uint32_t events, void* data) {
+		// select can not watch anything above FD_SETSIZE
+		if (fd < 0 || fd >= FD_SETSIZE) return EMFILE;
+		m_fds[fd] = entry{events, data};
+		return 0;
+	}
+
+	int select_poller::modify(int fd, uint32_t events, void* data) {
+		auto it = m_fds.find(fd);
+		if (it == m_fds.end()) return ENOENT;
+		it->second = entry{events, data};
+		return 0;
+	}
+
+	void select_poller::remove(int fd) {
+		m_fds.erase(fd);
+	}
+
+	int select_poller::wait(event* out, size_t max, int timeout_ms) {
+		fd_set rset;
+		fd_set wset;
+		FD_ZERO(&rset);
+		FD_ZERO(&wset);
+		int max_fd = -1;
+		for (auto& e : m_fds) {
+			if (e.second.events & readable) FD_SET(e.first, &rset);
+			if (e.second.events & writable) FD_SET(e.first, &wset);
+			max_fd = e.first;
+		}
+		struct timeval tv {};
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		auto res = select(max_fd + 1, &rset, &wset, nullptr, timeout_ms < 0 ? nullptr : &tv);
+		if (res <= 0) return res;
+		size_t n = 0;
+		for (auto& e : m_fds) {
+			if (n == max) break;
+			uint32_t ev = 0;
+			if (FD_ISSET(e.first, &rset)) ev |= readable;
+			if (FD_ISSET(e.first, &wset)) ev |= writable;
+			if (ev != 0) out[n++] = event{e.second.data, ev, 0, nullptr, 0};
+		}
+		return static_cast<int>(n);
+	}
+
+	namespace {
+		uint32_t to_epoll_events(uint32_t events) {
+			uint32_t res = 0;
+			if (events & poller::readable) res |= EPOLLIN | EPOLLRDHUP;
+			if (events & poller::writable) res |= EPOLLOUT;
+			return res;
+		}
+	} // namespace
+
+	epoll_poller::epoll_poller()
+		: m_fd{epoll_create1(EPOLL_CLOEXEC)} {
+		if (m_fd < 0) throw std::system_error(std::error_code(errno, std::system_category()));
+	}
+
+	epoll_poller::~epoll_poller() {
+		::close(m_fd);
+	}
+
+	int epoll_poller::add(int fd, uint32_t events, void* data) {
+		struct epoll_event ev {};
+		ev.events = to_epoll_events(events);
+		ev.data.ptr = data;
+		if (epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev) != 0) return errno;
+		return 0;
+	}
+
+	int epoll_poller::modify(int fd, uint32_t events, void* data) {
+		struct epoll_event ev {};
+		ev.events = to_epoll_events(events);
+		ev.data.ptr = data;
+		if (epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &ev) != 0) return errno;
+		return 0;
+	}
+
+	void epoll_poller::remove(int fd) {
+		epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+
+	int epoll_poller::wait(event* out, size_t max, int timeout_ms) {
+		struct epoll_event events[64];
+		auto res = epoll_wait(m_fd, events, static_cast<int>(std::min<size_t>(max, 64)), timeout_ms);
+		if (res <= 0) return res;
+		for (int i = 0; i < res; i++) {
+			uint32_t ev = 0;
+			if (events[i].events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) ev |= readable;
+			if (events[i].events & EPOLLOUT) ev |= writable;
+			if (events[i].events & (EPOLLHUP | EPOLLERR)) ev |= hangup | readable;
+			out[i] = event{events[i].data.ptr, ev, 0, nullptr, 0};
+		}
+		return res;
+	}
+} // namespace docker_plugin
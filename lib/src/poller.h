@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+
+struct iovec;
+
+namespace docker_plugin {
+	enum class io_backend;
+
+	/**
+	 * \brief Event notification interface used by uds_server.
+	 *
+	 * File descriptors are registered once together with an opaque pointer,
+	 * wait() only reports descriptors that are actually ready. Readiness based
+	 * implementations report readable/writable and leave the actual I/O to the
+	 * caller, completion based implementations perform accept and recv
+	 * themselves and report the result as accepted/received.
+	 */
+	class poller {
+	public:
+		static constexpr uint32_t readable = 1;
+		static constexpr uint32_t writable = 2;
+		static constexpr uint32_t hangup = 4;
+		// Completion: result holds the accepted file descriptor
+		static constexpr uint32_t accepted = 8;
+		// Completion: buffer/length hold the received bytes, valid until the next wait()
+		static constexpr uint32_t received = 16;
+
+		struct event {
+			void* data;
+			uint32_t events;
+			int result;
+			const void* buffer;
+			size_t length;
+		};
+
+		virtual ~poller() = default;
+
+		/**
+		 * \brief Start watching fd for the specified events.
+		 * \return 0 on success or an errno value
+		 */
+		virtual int add(int fd, uint32_t events, void* data) = 0;
+		/**
+		 * \brief Start watching a listening socket.
+		 * \return 0 on success or an errno value
+		 */
+		virtual int add_listener(int fd, void* data) { return add(fd, readable, data); }
+		/**
+		 * \brief Start watching a connected stream socket.
+		 * \return 0 on success or an errno value
+		 */
+		virtual int add_stream(int fd, void* data) { return add(fd, readable, data); }
+		/**
+		 * \brief Change the events watched for an already added fd.
+		 * \return 0 on success or an errno value
+		 */
+		virtual int modify(int fd, uint32_t events, void* data) = 0;
+		/**
+		 * \brief Stop watching fd. Needs to be called before the fd is closed.
+		 */
+		virtual void remove(int fd) = 0;
+		/**
+		 * \brief Wait up to timeout_ms for events.
+		 * \return Number of events stored in out or -1 and errno set on error.
+		 */
+		virtual int wait(event* out, size_t max, int timeout_ms) = 0;
+		/**
+		 * \brief Send a list of buffers on a stream added using add_stream with a single call, without blocking.
+		 * \return Number of bytes accepted (possibly 0) or SIZE_MAX on error
+		 */
+		virtual size_t sendv(int fd, const iovec* iov, size_t count);
+		/**
+		 * \brief Send data on a stream added using add_stream without blocking.
+		 * \return Number of bytes accepted (possibly 0) or SIZE_MAX on error
+		 */
+		size_t send(int fd, const void* data, size_t len);
+		/**
+		 * \brief Number of bytes accepted by send() that are still owned by the poller.
+		 */
+		virtual size_t pending(int) const noexcept { return 0; }
+		/**
+		 * \brief File descriptor that becomes readable once wait() has events to report, -1 if unsupported.
+		 * Lets another event loop watch this one, it calls wait() with a timeout of 0 once the fd is readable.
+		 */
+		virtual int get_fd() const noexcept { return -1; }
+		/**
+		 * \brief Hand everything queued since the last wait() to the kernel without waiting.
+		 * Needed before control returns to another event loop instead of calling wait() again.
+		 */
+		virtual void submit() {}
+
+		/**
+		 * \brief Create a poller for the requested backend.
+		 *
+		 * Falls back to the next simpler backend (io_uring -> epoll -> select) if
+		 * the requested one is not supported by the kernel or the build.
+		 */
+		static std::unique_ptr<poller> create(io_backend backend);
+	};
+
+	class select_poller : public poller {
+		struct entry {
+			uint32_t events;
+			void* data;
+		};
+		std::map<int, entry> m_fds{};
+
+	public:
+		int add(int fd, uint32_t events, void* data) override;
+		int modify(int fd, uint32_t events, void* data) override;
+		void remove(int fd) override;
+		int wait(event* out, size_t max, int timeout_ms) override;
+	};
+
+	class epoll_poller : public poller {
+		epoll_poller(const epoll_poller&) = delete;
+		epoll_poller& operator=(const epoll_poller&) = delete;
+
+		int m_fd;
+
+	public:
+		epoll_poller();
+		~epoll_poller();
+
+		int add(int fd, uint32_t events, void* data) override;
+		int modify(int fd, uint32_t events, void* data) override;
+		void remove(int fd) override;
+		int wait(event* out, size_t max, int timeout_ms) override;
+		int get_fd() const noexcept override { return m_fd; }
+	};
+} // namespace docker_plugin
@@ -3,498 +3,578 @@
 #include "docker-plugin-cpp/network/api.h"
 #include "docker-plugin-cpp/plugin.h"
 #include "docker-plugin-cpp/volume/api.h"
-#include "picojson.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace docker_plugin {
-	template <>
-	std::string to_json<empty_type>(const empty_type&) { return ""; }
-
-	template <>
-	empty_type from_json<empty_type>(const std::string&) { return {}; }
-
-	template <>
-	std::string to_json<activate_response>(const activate_response& e) {
-		picojson::object obj;
-		picojson::array impls;
-		for (auto& x : e.implements)
-			impls.push_back(picojson::value(x));
-		obj["Implements"] = picojson::value(impls);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	std::string to_json<error_response>(const error_response& e) {
-		picojson::object obj;
-		obj["Err"] = picojson::value(e.error);
-		return picojson::value(obj).serialize();
-	}
-
 	namespace {
-		picojson::value convert_map(const std::unordered_map<std::string, std::string>& map) {
-			picojson::object obj;
-			for (auto& e : map)
-				obj[e.first] = picojson::value(e.second);
-			return picojson::value(obj);
+		/**
+		 * \brief Describes a single json member of a struct.
+		 */
+		template <typename TClass, typename TMember>
+		struct field {
+			std::string_view name;
+			TMember TClass::*member;
+			// Leave the member out when serializing if it is empty()
+			bool omit_empty;
+		};
+
+		template <typename TClass, typename TMember>
+		constexpr field<TClass, TMember> make_field(std::string_view name, TMember TClass::*member, bool omit_empty = false) {
+			return {name, member, omit_empty};
 		}
 
-		void convert_map(std::unordered_map<std::string, std::string>& map, const picojson::value& val) {
-			if (val.is<picojson::object>()) return;
-			auto& obj = val.get<picojson::object>();
-			for (auto& e : obj) {
-				if (!e.second.is<std::string>()) continue;
-				map.emplace(e.first, e.second.get<std::string>());
-			}
+		/**
+		 * \brief Json members of T, specialized for every serializable struct.
+		 *
+		 * Members are written in the listed order, members not listed are ignored.
+		 */
+		template <typename T>
+		struct json_fields;
+
+		template <>
+		struct json_fields<activate_response> {
+			static constexpr auto fields = std::make_tuple(make_field("Implements", &activate_response::implements));
+		};
+
+		template <>
+		struct json_fields<error_response> {
+			static constexpr auto fields = std::make_tuple(make_field("Err", &error_response::error));
+		};
+
+		// ============= Volume =============
+
+		template <>
+		struct json_fields<volume::volume_info> {
+			using T = volume::volume_info;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name), make_field("Mountpoint", &T::mountpoint),
+														   make_field("CreatedAt", &T::created_at), make_field("Status", &T::status));
+		};
+
+		template <>
+		struct json_fields<volume::create_request> {
+			using T = volume::create_request;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name), make_field("Opts", &T::options));
+		};
+
+		template <>
+		struct json_fields<volume::remove_request> {
+			using T = volume::remove_request;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name));
+		};
+
+		template <>
+		struct json_fields<volume::mount_request> {
+			using T = volume::mount_request;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name), make_field("ID", &T::id));
+		};
+
+		template <>
+		struct json_fields<volume::mount_response> {
+			using T = volume::mount_response;
+			static constexpr auto fields = std::make_tuple(make_field("Mountpoint", &T::mountpoint));
+		};
+
+		template <>
+		struct json_fields<volume::unmount_request> {
+			using T = volume::unmount_request;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name), make_field("ID", &T::id));
+		};
+
+		template <>
+		struct json_fields<volume::path_request> {
+			using T = volume::path_request;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name));
+		};
+
+		template <>
+		struct json_fields<volume::path_response> {
+			using T = volume::path_response;
+			static constexpr auto fields = std::make_tuple(make_field("Mountpoint", &T::mountpoint));
+		};
+
+		template <>
+		struct json_fields<volume::get_request> {
+			using T = volume::get_request;
+			static constexpr auto fields = std::make_tuple(make_field("Name", &T::name));
+		};
+
+		template <>
+		struct json_fields<volume::get_response> {
+			using T = volume::get_response;
+			static constexpr auto fields = std::make_tuple(make_field("Volume", &T::volume));
+		};
+
+		template <>
+		struct json_fields<volume::list_response> {
+			using T = volume::list_response;
+			static constexpr auto fields = std::make_tuple(make_field("Volumes", &T::volumes));
+		};
+
+		template <>
+		struct json_fields<decltype(volume::capabilities_response::capabilities)> {
+			using T = decltype(volume::capabilities_response::capabilities);
+			static constexpr auto fields = std::make_tuple(make_field("Scope", &T::scope));
+		};
+
+		template <>
+		struct json_fields<volume::capabilities_response> {
+			using T = volume::capabilities_response;
+			static constexpr auto fields = std::make_tuple(make_field("Capabilities", &T::capabilities));
+		};
+
+		// ============= Network =============
+
+		template <>
+		struct json_fields<network::capabilities_response> {
+			using T = network::capabilities_response;
+			static constexpr auto fields = std::make_tuple(make_field("Scope", &T::scope), make_field("ConnectivityScope", &T::connectivity_scope));
+		};
+
+		template <>
+		struct json_fields<network::ipam_data> {
+			using T = network::ipam_data;
+			static constexpr auto fields = std::make_tuple(make_field("AddressSpace", &T::address_space), make_field("Pool", &T::pool),
+														   make_field("Gateway", &T::gateway), make_field("AuxAddresses", &T::aux_addresses));
+		};
+
+		template <>
+		struct json_fields<network::create_network_request> {
+			using T = network::create_network_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("Options", &T::options),
+														   make_field("IPv4Data", &T::ipv4_data), make_field("IPv6Data", &T::ipv6_data));
+		};
+
+		template <>
+		struct json_fields<network::allocate_network_request> {
+			using T = network::allocate_network_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("Options", &T::options),
+														   make_field("IPv4Data", &T::ipv4_data), make_field("IPv6Data", &T::ipv6_data));
+		};
+
+		template <>
+		struct json_fields<network::allocate_network_response> {
+			using T = network::allocate_network_response;
+			static constexpr auto fields = std::make_tuple(make_field("Options", &T::options));
+		};
+
+		template <>
+		struct json_fields<network::delete_network_request> {
+			using T = network::delete_network_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id));
+		};
+
+		template <>
+		struct json_fields<network::free_network_request> {
+			using T = network::free_network_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id));
+		};
+
+		template <>
+		struct json_fields<network::endpoint_interface> {
+			using T = network::endpoint_interface;
+			static constexpr auto fields = std::make_tuple(make_field("Address", &T::ipv4_address), make_field("AddressIPv6", &T::ipv6_address),
+														   make_field("MacAddress", &T::mac_address));
+		};
+
+		template <>
+		struct json_fields<network::create_endpoint_request> {
+			using T = network::create_endpoint_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id),
+														   make_field("Interface", &T::interface), make_field("Options", &T::options));
+		};
+
+		template <>
+		struct json_fields<network::create_endpoint_response> {
+			using T = network::create_endpoint_response;
+			static constexpr auto fields = std::make_tuple(make_field("Interface", &T::interface, true));
+		};
+
+		template <>
+		struct json_fields<network::delete_endpoint_request> {
+			using T = network::delete_endpoint_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id));
+		};
+
+		template <>
+		struct json_fields<network::info_request> {
+			using T = network::info_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id));
+		};
+
+		template <>
+		struct json_fields<network::info_response> {
+			using T = network::info_response;
+			static constexpr auto fields = std::make_tuple(make_field("Value", &T::value));
+		};
+
+		template <>
+		struct json_fields<network::join_request> {
+			using T = network::join_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id),
+														   make_field("SandboxKey", &T::sandbox_key), make_field("Options", &T::options));
+		};
+
+		template <>
+		struct json_fields<network::static_route> {
+			using T = network::static_route;
+			static constexpr auto fields = std::make_tuple(make_field("Destination", &T::destination), make_field("RouteType", &T::route_type),
+														   make_field("NextHop", &T::next_hop));
+		};
+
+		template <>
+		struct json_fields<decltype(network::join_response::interface_name)> {
+			using T = decltype(network::join_response::interface_name);
+			static constexpr auto fields = std::make_tuple(make_field("SrcName", &T::src_name), make_field("DstPrefix", &T::dst_prefix));
+		};
+
+		template <>
+		struct json_fields<network::join_response> {
+			using T = network::join_response;
+			static constexpr auto fields = std::make_tuple(make_field("InterfaceName", &T::interface_name), make_field("Gateway", &T::gateway_ipv4),
+														   make_field("GatewayIPv6", &T::gateway_ipv6), make_field("DisableGatewayService", &T::disable_gateway_service),
+														   make_field("StaticRoutes", &T::static_routes));
+		};
+
+		template <>
+		struct json_fields<network::leave_request> {
+			using T = network::leave_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id));
+		};
+
+		template <>
+		struct json_fields<decltype(network::discovery_notification::node_info)> {
+			using T = decltype(network::discovery_notification::node_info);
+			static constexpr auto fields = std::make_tuple(make_field("Address", &T::address), make_field("self", &T::self));
+		};
+
+		template <>
+		struct json_fields<network::discovery_notification> {
+			using T = network::discovery_notification;
+			// DiscoveryData is only understood for node discovery, see finish_object()
+			static constexpr auto fields = std::make_tuple(make_field("DiscoveryType", &T::discovery_type), make_field("DiscoveryData", &T::node_info));
+		};
+
+		template <>
+		struct json_fields<network::program_external_connectivity_request> {
+			using T = network::program_external_connectivity_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id),
+														   make_field("Options", &T::options));
+		};
+
+		template <>
+		struct json_fields<network::revoke_external_connectivity_request> {
+			using T = network::revoke_external_connectivity_request;
+			static constexpr auto fields = std::make_tuple(make_field("NetworkID", &T::network_id), make_field("EndpointID", &T::endpoint_id));
+		};
+
+		// ============= IPAM =============
+
+		template <>
+		struct json_fields<ipam::capabilities_response> {
+			using T = ipam::capabilities_response;
+			static constexpr auto fields = std::make_tuple(make_field("RequiresMACAddress", &T::requires_mac_address));
+		};
+
+		template <>
+		struct json_fields<ipam::address_spaces_response> {
+			using T = ipam::address_spaces_response;
+			static constexpr auto fields = std::make_tuple(make_field("LocalDefaultAddressSpace", &T::local_default_address_space),
+														   make_field("GlobalDefaultAddressSpace", &T::global_default_address_space));
+		};
+
+		template <>
+		struct json_fields<ipam::request_pool_request> {
+			using T = ipam::request_pool_request;
+			static constexpr auto fields = std::make_tuple(make_field("AddressSpace", &T::address_space), make_field("Pool", &T::pool),
+														   make_field("SubPool", &T::sub_pool), make_field("Options", &T::options), make_field("V6", &T::ipv6));
+		};
+
+		template <>
+		struct json_fields<ipam::request_pool_response> {
+			using T = ipam::request_pool_response;
+			static constexpr auto fields = std::make_tuple(make_field("PoolID", &T::pool_id), make_field("Pool", &T::pool), make_field("Data", &T::data));
+		};
+
+		template <>
+		struct json_fields<ipam::release_pool_request> {
+			using T = ipam::release_pool_request;
+			static constexpr auto fields = std::make_tuple(make_field("PoolID", &T::pool_id));
+		};
+
+		template <>
+		struct json_fields<ipam::request_address_request> {
+			using T = ipam::request_address_request;
+			static constexpr auto fields = std::make_tuple(make_field("PoolID", &T::pool_id), make_field("Address", &T::address), make_field("Options", &T::options));
+		};
+
+		template <>
+		struct json_fields<ipam::request_address_response> {
+			using T = ipam::request_address_response;
+			static constexpr auto fields = std::make_tuple(make_field("Address", &T::address), make_field("Data", &T::data));
+		};
+
+		template <>
+		struct json_fields<ipam::release_address_request> {
+			using T = ipam::release_address_request;
+			static constexpr auto fields = std::make_tuple(make_field("PoolID", &T::pool_id), make_field("Address", &T::address));
+		};
+
+		// ============= Per type hooks =============
+
+		// Whether a decoded array element is kept
+		template <typename T>
+		bool keep_element(const T&) { return true; }
+		bool keep_element(const network::ipam_data& e) {
+			return !e.address_space.empty() || !e.pool.empty() || !e.gateway.empty() || !e.aux_addresses.empty();
 		}
 
-		std::string convert_time(std::chrono::system_clock::time_point tp) {
-			char time_buf[sizeof("2000-01-01T00:00:00Z")] = {};
-			auto now = std::chrono::system_clock::to_time_t(tp);
-			strftime(time_buf, sizeof(time_buf), "%FT%TZ", gmtime(&now));
-			return {time_buf};
+		// Called after all members of an object were decoded
+		template <typename T>
+		void finish_object(T&) {}
+		void finish_object(network::discovery_notification& e) {
+			// The type might come after the data, drop the data if it was not node data
+			if (e.discovery_type != network::discovery_notification::type::node) e.node_info = {};
 		}
-	} // namespace
-
-	picojson::object parse_object(const std::string& str) {
-		picojson::value val;
-		auto err = picojson::parse(val, str);
-		if (!err.empty()) throw std::invalid_argument(err);
-		if (!val.is<picojson::object>()) throw std::invalid_argument("not a json object");
-		return val.get<picojson::object>();
-	}
-
-	template <>
-	volume::create_request from_json<volume::create_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		volume::create_request res;
-		if (obj.count("Name") != 0 && obj.at("Name").is<std::string>())
-			res.name = obj.at("Name").get<std::string>();
-		if (obj.count("Opts") != 0)
-			convert_map(res.options, obj.at("Opts"));
-		return res;
-	}
 
-	template <>
-	volume::remove_request from_json<volume::remove_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		volume::remove_request res;
-		if (obj.count("Name") != 0 && obj.at("Name").is<std::string>())
-			res.name = obj.at("Name").get<std::string>();
-		return res;
-	}
-
-	template <>
-	volume::mount_request from_json<volume::mount_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		volume::mount_request res;
-		if (obj.count("Name") != 0 && obj.at("Name").is<std::string>())
-			res.name = obj.at("Name").get<std::string>();
-		if (obj.count("ID") != 0 && obj.at("ID").is<std::string>())
-			res.id = obj.at("ID").get<std::string>();
-		return res;
-	}
-
-	picojson::value to_json_raw(const volume::volume_info& e) {
-		picojson::object obj;
-		obj["Name"] = picojson::value(e.name);
-		obj["Mountpoint"] = picojson::value(e.mountpoint);
-		obj["CreatedAt"] = picojson::value(convert_time(e.created_at));
-		obj["Status"] = convert_map(e.status);
-		return picojson::value(obj);
-	}
-
-	template <>
-	std::string to_json<volume::mount_response>(const volume::mount_response& e) {
-		picojson::object obj;
-		obj["Mountpoint"] = picojson::value(e.mountpoint);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	volume::unmount_request from_json<volume::unmount_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		volume::unmount_request res;
-		if (obj.count("Name") != 0 && obj.at("Name").is<std::string>())
-			res.name = obj.at("Name").get<std::string>();
-		if (obj.count("ID") != 0 && obj.at("ID").is<std::string>())
-			res.id = obj.at("ID").get<std::string>();
-		return res;
-	}
-
-	template <>
-	volume::path_request from_json<volume::path_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		volume::path_request res;
-		if (obj.count("Name") != 0 && obj.at("Name").is<std::string>())
-			res.name = obj.at("Name").get<std::string>();
-		return res;
-	}
-
-	template <>
-	std::string to_json<volume::path_response>(const volume::path_response& e) {
-		picojson::object obj;
-		obj["Mountpoint"] = picojson::value(e.mountpoint);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	volume::get_request from_json<volume::get_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		volume::get_request res;
-		if (obj.count("Name") != 0 && obj.at("Name").is<std::string>())
-			res.name = obj.at("Name").get<std::string>();
-		return res;
-	}
-
-	template <>
-	std::string to_json<volume::get_response>(const volume::get_response& e) {
-		picojson::object obj;
-		obj["Volume"] = to_json_raw(e.volume);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	std::string to_json<volume::list_response>(const volume::list_response& e) {
-		picojson::array arr;
-		for (auto& x : e.volumes)
-			arr.push_back(to_json_raw(x));
-		picojson::object obj;
-		obj["Volumes"] = picojson::value(arr);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	std::string to_json<volume::capabilities_response>(const volume::capabilities_response& e) {
-		picojson::object caps;
-		caps["Scope"] = picojson::value(e.capabilities.scope);
-		picojson::object obj;
-		obj["Capabilities"] = picojson::value(caps);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	std::string to_json<network::capabilities_response>(const network::capabilities_response& e) {
-		picojson::object obj;
-		obj["Scope"] = picojson::value(e.scope);
-		obj["ConnectivityScope"] = picojson::value(e.connectivity_scope);
-		return picojson::value(obj).serialize();
-	}
-
-	namespace {
-		std::vector<network::ipam_data> parse_ipam_data(const picojson::value& val) {
-			if (!val.is<picojson::array>()) return {};
-			auto& arr = val.get<picojson::array>();
-			std::vector<network::ipam_data> res;
-			for (auto& e : arr) {
-				if (!e.is<picojson::object>()) continue;
-				auto& obj = e.get<picojson::object>();
-				network::ipam_data data;
-				if (obj.count("AddressSpace") != 0 && obj.at("AddressSpace").is<std::string>())
-					data.address_space = obj.at("AddressSpace").get<std::string>();
-				if (obj.count("Pool") != 0 && obj.at("Pool").is<std::string>())
-					data.pool = obj.at("Pool").get<std::string>();
-				if (obj.count("Gateway") != 0 && obj.at("Gateway").is<std::string>())
-					data.gateway = obj.at("Gateway").get<std::string>();
-				if (obj.count("AuxAddresses") != 0)
-					convert_map(data.aux_addresses, obj.at("AuxAddresses"));
-				if (!data.address_space.empty() || !data.pool.empty() || !data.gateway.empty() || !data.aux_addresses.empty())
-					res.push_back(std::move(data));
+		// ============= Generic encoder/decoder =============
+
+		template <typename T, template <typename...> class TTemplate>
+		struct is_instance : std::false_type {};
+		template <template <typename...> class TTemplate, typename... TArgs>
+		struct is_instance<TTemplate<TArgs...>, TTemplate> : std::true_type {};
+
+		template <typename T>
+		struct is_small_map : std::false_type {};
+		template <typename TKey, typename TValue, size_t N>
+		struct is_small_map<small_map<TKey, TValue, N>> : std::true_type {};
+
+		template <typename T, typename = void>
+		struct has_empty : std::false_type {};
+		template <typename T>
+		struct has_empty<T, std::void_t<decltype(std::declval<const T&>().empty())>> : std::true_type {};
+
+		template <typename T>
+		void write_value(json_writer& wr, const T& val) {
+			if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, bool>) {
+				wr.value(val);
+			} else if constexpr (std::is_same_v<T, docker_id>) {
+				if (val.is_hex()) {
+					char buf[docker_id::hex_length];
+					wr.value(std::string_view{buf, val.format(buf)});
+				} else
+					wr.value(std::string_view{val.text(), val.size()});
+			} else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+				wr.value(static_cast<int64_t>(val));
+			} else if constexpr (std::is_same_v<T, std::chrono::system_clock::time_point>) {
+				char time_buf[sizeof("2000-01-01T00:00:00Z")] = {};
+				auto time = std::chrono::system_clock::to_time_t(val);
+				struct tm tm_info;
+				strftime(time_buf, sizeof(time_buf), "%FT%TZ", gmtime_r(&time, &tm_info));
+				wr.value(std::string_view{time_buf});
+			} else if constexpr (is_small_map<T>::value) {
+				wr.begin_object();
+				for (auto& e : val) {
+					wr.key(e.first);
+					write_value(wr, e.second);
+				}
+				wr.end_object();
+			} else if constexpr (is_instance<T, std::vector>::value || is_instance<T, std::set>::value) {
+				wr.begin_array();
+				for (auto& e : val)
+					write_value(wr, e);
+				wr.end_array();
+			} else {
+				auto write_field = [&](auto& f) {
+					auto& member = val.*f.member;
+					if constexpr (has_empty<std::decay_t<decltype(member)>>::value) {
+						if (f.omit_empty && member.empty()) return;
+					}
+					wr.key(f.name);
+					write_value(wr, member);
+				};
+				wr.begin_object();
+				std::apply([&](auto&... fields) { (write_field(fields), ...); }, json_fields<T>::fields);
+				wr.end_object();
 			}
-			return res;
 		}
-	} // namespace
-
-	template <>
-	network::create_network_request from_json<network::create_network_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::create_network_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("Options") != 0)
-			convert_map(res.options, obj.at("Options"));
-		if (obj.count("IPv4Data") != 0) res.ipv4_data = parse_ipam_data(obj.at("IPv4Data"));
-		if (obj.count("IPv4Data") != 0) res.ipv4_data = parse_ipam_data(obj.at("IPv4Data"));
-		return res;
-	}
-
-	template <>
-	network::allocate_network_request from_json<network::allocate_network_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::allocate_network_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("Options") != 0)
-			convert_map(res.options, obj.at("Options"));
-		if (obj.count("IPv4Data") != 0) res.ipv4_data = parse_ipam_data(obj.at("IPv4Data"));
-		if (obj.count("IPv4Data") != 0) res.ipv4_data = parse_ipam_data(obj.at("IPv4Data"));
-		return res;
-	}
-
-	template <>
-	std::string to_json<network::allocate_network_response>(const network::allocate_network_response& e) {
-		picojson::object obj;
-		obj["Options"] = convert_map(e.options);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	network::delete_network_request from_json<network::delete_network_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::delete_network_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		return res;
-	}
 
-	template <>
-	network::free_network_request from_json<network::free_network_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::free_network_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		return res;
-	}
-
-	namespace {
-		network::endpoint_interface parse_endpoint_interface(const picojson::value& val) {
-			network::endpoint_interface res;
-			if (!val.is<picojson::object>()) return res;
-			auto& obj = val.get<picojson::object>();
-			if (obj.count("Address") != 0 && obj.at("Address").is<std::string>())
-				res.ipv4_address = obj.at("Address").get<std::string>();
-			if (obj.count("AddressIPv6") != 0 && obj.at("AddressIPv6").is<std::string>())
-				res.ipv6_address = obj.at("AddressIPv6").get<std::string>();
-			if (obj.count("MacAddress") != 0 && obj.at("MacAddress").is<std::string>())
-				res.mac_address = obj.at("MacAddress").get<std::string>();
-			return res;
+		// Walk the members of an object, fn returns false for members it did not consume
+		template <typename TFn>
+		bool read_object(json_reader& rd, TFn&& fn) {
+			if (rd.peek() != json_reader::type::object) {
+				rd.skip();
+				return false;
+			}
+			rd.begin_object();
+			std::string_view key;
+			while (rd.next_member(key)) {
+				if (!fn(key)) rd.skip();
+			}
+			return true;
 		}
 
-		picojson::value serialize_endpoint_interface(const network::endpoint_interface& ei) {
-			picojson::object obj;
-			obj["Address"] = picojson::value(ei.ipv4_address);
-			obj["AddressIPv6"] = picojson::value(ei.ipv6_address);
-			obj["MacAddress"] = picojson::value(ei.mac_address);
-			return picojson::value(obj);
+		template <typename T, typename = void>
+		struct has_clear : std::false_type {};
+		template <typename T>
+		struct has_clear<T, std::void_t<decltype(std::declval<T&>().clear())>> : std::true_type {};
+
+		// Back to the default value, keeping storage where possible
+		template <typename T>
+		void reset_value(T& val) {
+			if constexpr (has_clear<T>::value)
+				val.clear();
+			else
+				val = T{};
 		}
-	} // namespace
-
-	template <>
-	network::create_endpoint_request from_json<network::create_endpoint_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::create_endpoint_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		if (obj.count("Interface") != 0) res.interface = parse_endpoint_interface(obj.at("Interface"));
-		if (obj.count("Options") != 0) convert_map(res.options, obj.at("Options"));
-		return res;
-	}
-
-	template <>
-	std::string to_json<network::create_endpoint_response>(const network::create_endpoint_response& e) {
-		picojson::object obj;
-		if (!e.interface.empty()) obj["Interface"] = serialize_endpoint_interface(e.interface);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	network::delete_endpoint_request from_json<network::delete_endpoint_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::delete_endpoint_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		return res;
-	}
 
-	template <>
-	network::info_request from_json<network::info_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::info_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		return res;
-	}
-
-	template <>
-	std::string to_json<network::info_response>(const network::info_response& e) {
-		picojson::object obj;
-		obj["Value"] = convert_map(e.value);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	network::join_request from_json<network::join_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::join_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		if (obj.count("SandboxKey") != 0 && obj.at("SandboxKey").is<std::string>())
-			res.sandbox_key = obj.at("SandboxKey").get<std::string>();
-		if (obj.count("Options") != 0) convert_map(res.options, obj.at("Options"));
-		return res;
-	}
-
-	template <>
-	std::string to_json<network::join_response>(const network::join_response& e) {
-		picojson::object obj;
-		picojson::object ifname;
-		ifname["SrcName"] = picojson::value(e.interface_name.src_name);
-		ifname["DstPrefix"] = picojson::value(e.interface_name.dst_prefix);
-		obj["InterfaceName"] = picojson::value(ifname);
-		obj["Gateway"] = picojson::value(e.gateway_ipv4);
-		obj["GatewayIPv6"] = picojson::value(e.gateway_ipv6);
-		obj["DisableGatewayService"] = picojson::value(e.disable_gateway_service);
-		picojson::array routes;
-		for (auto& r : e.static_routes) {
-			picojson::object route;
-			route["Destination"] = picojson::value(r.destination);
-			route["RouteType"] = picojson::value(int64_t(r.route_type));
-			route["NextHop"] = picojson::value(r.next_hop);
-			routes.push_back(picojson::value(route));
+		template <typename T, size_t... I>
+		void read_fields(json_reader& rd, T& val, std::index_sequence<I...>);
+
+		/**
+		 * \brief Decode the next value into val, reusing the storage it holds.
+		 * Values of a different type are skipped and leave val untouched.
+		 * \return true if the value was decoded
+		 */
+		template <typename T>
+		bool read_value(json_reader& rd, T& val) {
+			if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, bool>) {
+				return rd.read(val);
+			} else if constexpr (std::is_same_v<T, docker_id>) {
+				std::string_view str;
+				if (!rd.read(str)) return false;
+				val.assign(str.data(), str.size());
+				return true;
+			} else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+				int64_t i;
+				if (!rd.read(i)) return false;
+				val = static_cast<T>(i);
+				return true;
+			} else if constexpr (is_small_map<T>::value) {
+				if (rd.peek() != json_reader::type::object) {
+					rd.skip();
+					return false;
+				}
+				val.clear();
+				typename T::mapped_type value{};
+				return read_object(rd, [&](std::string_view key) {
+					if (read_value(rd, value)) val.insert_or_assign(typename T::key_type{key}, std::move(value));
+					return true;
+				});
+			} else if constexpr (is_instance<T, std::vector>::value) {
+				if (rd.peek() != json_reader::type::array) {
+					rd.skip();
+					return false;
+				}
+				// Elements already there are decoded into in place
+				size_t size = 0;
+				rd.begin_array();
+				while (rd.next_element()) {
+					if (size == val.size()) val.emplace_back();
+					if (read_value(rd, val[size]) && keep_element(val[size])) size++;
+				}
+				val.erase(val.begin() + size, val.end());
+				return true;
+			} else {
+				if (rd.peek() != json_reader::type::object) {
+					rd.skip();
+					return false;
+				}
+				rd.begin_object();
+				read_fields(rd, val, std::make_index_sequence<std::tuple_size_v<decltype(json_fields<T>::fields)>>{});
+				finish_object(val);
+				return true;
+			}
 		}
-		obj["StaticRoutes"] = picojson::value(routes);
-		return picojson::value(obj).serialize();
-	}
 
-	template <>
-	network::leave_request from_json<network::leave_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::leave_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		return res;
-	}
-
-	template <>
-	network::discovery_notification from_json<network::discovery_notification>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::discovery_notification res;
-		if (obj.count("DiscoveryType") != 0 && obj.at("DiscoveryType").is<int64_t>())
-			res.discovery_type = static_cast<network::discovery_notification::type>(obj.at("DiscoveryType").get<int64_t>());
-		if (obj.count("DiscoveryData") != 0 && obj.at("DiscoveryData").is<picojson::object>()) {
-			auto& data = obj.at("DiscoveryData").get<picojson::object>();
-			switch (res.discovery_type) {
-			default: return res;
-			case network::discovery_notification::type::node: {
-				if (data.count("Address") != 0 && data.at("Address").is<std::string>())
-					res.node_info.address = data.at("Address").get<std::string>();
-				if (data.count("self") != 0 && data.at("self").is<bool>())
-					res.node_info.self = data.at("self").get<bool>();
-			} break;
+		/**
+		 * \brief Decode the members of an object into val, the opening brace was consumed already.
+		 * Members that are missing or had the wrong type are reset, the others reuse the storage they hold.
+		 */
+		template <typename T, size_t... I>
+		void read_fields(json_reader& rd, T& val, std::index_sequence<I...>) {
+			static_assert(sizeof...(I) <= 64, "too many fields");
+			constexpr auto& fields = json_fields<T>::fields;
+			uint64_t seen = 0;
+			// Members are matched by length and content, so this compiles down to a short compare chain
+			auto read_field = [&](std::string_view key, auto& f, uint64_t bit) {
+				if (key != f.name) return false;
+				if (read_value(rd, val.*f.member)) seen |= bit;
+				return true;
+			};
+			std::string_view key;
+			while (rd.next_member(key)) {
+				if (!(read_field(key, std::get<I>(fields), uint64_t{1} << I) || ...)) rd.skip();
 			}
+			(((seen & (uint64_t{1} << I)) != 0 || (reset_value(val.*std::get<I>(fields).member), true)), ...);
 		}
-		return res;
-	}
-
-	template <>
-	network::program_external_connectivity_request from_json<network::program_external_connectivity_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::program_external_connectivity_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		if (obj.count("Options") != 0) convert_map(res.options, obj.at("Options"));
-		return res;
-	}
-
-	template <>
-	network::revoke_external_connectivity_request from_json<network::revoke_external_connectivity_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		network::revoke_external_connectivity_request res;
-		if (obj.count("NetworkID") != 0 && obj.at("NetworkID").is<std::string>())
-			res.network_id = obj.at("NetworkID").get<std::string>();
-		if (obj.count("EndpointID") != 0 && obj.at("EndpointID").is<std::string>())
-			res.endpoint_id = obj.at("EndpointID").get<std::string>();
-		return res;
-	}
-
-	template <>
-	std::string to_json<ipam::capabilities_response>(const ipam::capabilities_response& e) {
-		picojson::object obj;
-		obj["RequiresMACAddress"] = picojson::value(e.requires_mac_address);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	std::string to_json<ipam::address_spaces_response>(const ipam::address_spaces_response& e) {
-		picojson::object obj;
-		obj["LocalDefaultAddressSpace"] = picojson::value(e.local_default_address_space);
-		obj["GlobalDefaultAddressSpace"] = picojson::value(e.local_default_address_space);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	ipam::request_pool_request from_json<ipam::request_pool_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		ipam::request_pool_request res;
-		if (obj.count("AddressSpace") != 0 && obj.at("AddressSpace").is<std::string>())
-			res.address_space = obj.at("AddressSpace").get<std::string>();
-		if (obj.count("Pool") != 0 && obj.at("Pool").is<std::string>())
-			res.pool = obj.at("Pool").get<std::string>();
-		if (obj.count("SubPool") != 0 && obj.at("SubPool").is<std::string>())
-			res.sub_pool = obj.at("SubPool").get<std::string>();
-		if (obj.count("Options") != 0) convert_map(res.options, obj.at("Options"));
-		if (obj.count("V6") != 0 && obj.at("V6").is<bool>())
-			res.ipv6 = obj.at("V6").get<bool>();
-		return res;
-	}
-
-	template <>
-	std::string to_json<ipam::request_pool_response>(const ipam::request_pool_response& e) {
-		picojson::object obj;
-		obj["PoolID"] = picojson::value(e.pool_id);
-		obj["Pool"] = picojson::value(e.pool);
-		obj["Data"] = convert_map(e.data);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	ipam::release_pool_request from_json<ipam::release_pool_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		ipam::release_pool_request res;
-		if (obj.count("PoolID") != 0 && obj.at("PoolID").is<std::string>())
-			res.pool_id = obj.at("PoolID").get<std::string>();
-		return res;
-	}
-
-	template <>
-	ipam::request_address_request from_json<ipam::request_address_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		ipam::request_address_request res;
-		if (obj.count("PoolID") != 0 && obj.at("PoolID").is<std::string>())
-			res.pool_id = obj.at("PoolID").get<std::string>();
-		if (obj.count("Address") != 0 && obj.at("Address").is<std::string>())
-			res.address = obj.at("Address").get<std::string>();
-		if (obj.count("Options") != 0) convert_map(res.options, obj.at("Options"));
-		return res;
-	}
-
-	template <>
-	std::string to_json<ipam::request_address_response>(const ipam::request_address_response& e) {
-		picojson::object obj;
-		obj["Address"] = picojson::value(e.address);
-		obj["Data"] = convert_map(e.data);
-		return picojson::value(obj).serialize();
-	}
-
-	template <>
-	ipam::release_address_request from_json<ipam::release_address_request>(const std::string& str) {
-		auto obj = parse_object(str);
-		ipam::release_address_request res;
-		if (obj.count("PoolID") != 0 && obj.at("PoolID").is<std::string>())
-			res.pool_id = obj.at("PoolID").get<std::string>();
-		if (obj.count("Address") != 0 && obj.at("Address").is<std::string>())
-			res.address = obj.at("Address").get<std::string>();
-		return res;
-	}
+	} // namespace
 
-} // namespace docker_plugin
\ No newline at end of file
+	template <typename T>
+	void to_json(std::string& out, const T& e) {
+		json_writer wr{out};
+		write_value(wr, e);
+	}
+
+	template <typename T>
+	void from_json(const std::string& str, T& out) {
+		json_reader rd{str};
+		if (rd.peek() != json_reader::type::object) throw std::invalid_argument("not a json object");
+		read_value(rd, out);
+	}
+
+	template <>
+	void to_json<empty_type>(std::string&, const empty_type&) {}
+
+	template <>
+	void from_json<empty_type>(const std::string&, empty_type&) {}
+
+	// Every api type used by plugin.cpp, a new type needs its json_fields and a line here
+	template void to_json<activate_response>(std::string&, const activate_response&);
+	template void to_json<error_response>(std::string&, const error_response&);
+
+	template void from_json<volume::create_request>(const std::string&, volume::create_request&);
+	template void from_json<volume::remove_request>(const std::string&, volume::remove_request&);
+	template void from_json<volume::mount_request>(const std::string&, volume::mount_request&);
+	template void to_json<volume::mount_response>(std::string&, const volume::mount_response&);
+	template void from_json<volume::unmount_request>(const std::string&, volume::unmount_request&);
+	template void from_json<volume::path_request>(const std::string&, volume::path_request&);
+	template void to_json<volume::path_response>(std::string&, const volume::path_response&);
+	template void from_json<volume::get_request>(const std::string&, volume::get_request&);
+	template void to_json<volume::get_response>(std::string&, const volume::get_response&);
+	template void to_json<volume::volume_info>(std::string&, const volume::volume_info&);
+	template void to_json<volume::list_response>(std::string&, const volume::list_response&);
+	template void to_json<volume::capabilities_response>(std::string&, const volume::capabilities_response&);
+
+	template void to_json<network::capabilities_response>(std::string&, const network::capabilities_response&);
+	template void from_json<network::create_network_request>(const std::string&, network::create_network_request&);
+	template void from_json<network::allocate_network_request>(const std::string&, network::allocate_network_request&);
+	template void to_json<network::allocate_network_response>(std::string&, const network::allocate_network_response&);
+	template void from_json<network::delete_network_request>(const std::string&, network::delete_network_request&);
+	template void from_json<network::free_network_request>(const std::string&, network::free_network_request&);
+	template void from_json<network::create_endpoint_request>(const std::string&, network::create_endpoint_request&);
+	template void to_json<network::create_endpoint_response>(std::string&, const network::create_endpoint_response&);
+	template void from_json<network::delete_endpoint_request>(const std::string&, network::delete_endpoint_request&);
+	template void from_json<network::info_request>(const std::string&, network::info_request&);
+	template void to_json<network::info_response>(std::string&, const network::info_response&);
+	template void from_json<network::join_request>(const std::string&, network::join_request&);
+	template void to_json<network::join_response>(std::string&, const network::join_response&);
+	template void from_json<network::leave_request>(const std::string&, network::leave_request&);
+	template void from_json<network::discovery_notification>(const std::string&, network::discovery_notification&);
+	template void from_json<network::program_external_connectivity_request>(const std::string&, network::program_external_connectivity_request&);
+	template void from_json<network::revoke_external_connectivity_request>(const std::string&, network::revoke_external_connectivity_request&);
+
+	template void to_json<ipam::capabilities_response>(std::string&, const ipam::capabilities_response&);
+	template void to_json<ipam::address_spaces_response>(std::string&, const ipam::address_spaces_response&);
+	template void from_json<ipam::request_pool_request>(const std::string&, ipam::request_pool_request&);
+	template void to_json<ipam::request_pool_response>(std::string&, const ipam::request_pool_response&);
+	template void from_json<ipam::release_pool_request>(const std::string&, ipam::release_pool_request&);
+	template void from_json<ipam::request_address_request>(const std::string&, ipam::request_address_request&);
+	template void to_json<ipam::request_address_response>(std::string&, const ipam::request_address_response&);
+	template void from_json<ipam::release_address_request>(const std::string&, ipam::release_address_request&);
+} // namespace docker_plugin
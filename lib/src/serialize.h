@@ -2,8 +2,26 @@
 #include <string>
 
 namespace docker_plugin {
+	/**
+	 * \brief Append the json representation of e to out.
+	 */
 	template <typename T>
-	std::string to_json(const T& e);
+	void to_json(std::string& out, const T& e);
 	template <typename T>
-	T from_json(const std::string& str);
+	std::string to_json(const T& e) {
+		std::string res;
+		to_json<T>(res, e);
+		return res;
+	}
+	/**
+	 * \brief Decode str into out, reusing the memory out already owns for strings and containers.
+	 */
+	template <typename T>
+	void from_json(const std::string& str, T& out);
+	template <typename T>
+	T from_json(const std::string& str) {
+		T res{};
+		from_json<T>(str, res);
+		return res;
+	}
 } // namespace docker_plugin
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "timer_wheel.h"
+#include <algorithm>
+
+namespace docker_plugin {
+	void timer::link_before(timer& pos) noexcept {
+		m_prev = pos.m_prev;
+		m_next = &pos;
+		pos.m_prev->m_next = this;
+		pos.m_prev = this;
+	}
+
+	void timer::unlink() noexcept {
+		m_prev->m_next = m_next;
+		m_next->m_prev = m_prev;
+		m_prev = m_next = nullptr;
+	}
+
+	void timer::cancel() noexcept {
+		if (!armed()) return;
+		unlink();
+		// List head left behind by a handler that threw
+		if (m_wheel == nullptr) return;
+		m_fn = nullptr;
+		auto& head = m_wheel->m_slots[m_slot];
+		if (head.m_next == &head) m_wheel->m_occupied[m_slot / timer_wheel::level_slots] &= ~(uint64_t{1} << (m_slot % timer_wheel::level_slots));
+		m_wheel->m_armed--;
+		m_wheel = nullptr;
+	}
+
+	timer_wheel::timer_wheel(std::chrono::milliseconds resolution)
+		: m_start{std::chrono::steady_clock::now()}, m_resolution{resolution.count() > 0 ? resolution : std::chrono::milliseconds{1}} {
+		for (auto& e : m_slots)
+			e.m_prev = e.m_next = &e;
+	}
+
+	timer_wheel::~timer_wheel() {
+		for (auto& e : m_slots) {
+			while (e.m_next != &e)
+				e.m_next->cancel();
+			e.m_prev = e.m_next = nullptr;
+		}
+	}
+
+	uint64_t timer_wheel::tick_of(std::chrono::steady_clock::time_point time) const noexcept {
+		if (time <= m_start) return 0;
+		return static_cast<uint64_t>((time - m_start) / m_resolution);
+	}
+
+	void timer_wheel::place(timer& t) noexcept {
+		constexpr uint64_t range = uint64_t{1} << (level_bits * level_count);
+		auto delta = t.m_expires > m_tick ? t.m_expires - m_tick : 0;
+		size_t level = 0;
+		while (level + 1 < level_count && delta >= (uint64_t{1} << (level_bits * (level + 1))))
+			level++;
+		// Out of range timers wait in the last slot and get placed again from there
+		auto pos = delta >= range ? m_tick + range - 1 : std::max(t.m_expires, m_tick);
+		auto idx = (pos >> (level_bits * level)) & (level_slots - 1);
+		t.m_slot = static_cast<uint32_t>(level * level_slots + idx);
+		t.link_before(m_slots[t.m_slot]);
+		m_occupied[level] |= uint64_t{1} << idx;
+	}
+
+	void timer_wheel::detach(size_t slot, timer& list) noexcept {
+		auto& head = m_slots[slot];
+		list.m_prev = list.m_next = &list;
+		m_occupied[slot / level_slots] &= ~(uint64_t{1} << (slot % level_slots));
+		if (head.m_next == &head) return;
+		list.m_next = head.m_next;
+		list.m_prev = head.m_prev;
+		list.m_next->m_prev = &list;
+		list.m_prev->m_next = &list;
+		head.m_prev = head.m_next = &head;
+	}
+
+	void timer_wheel::cascade(size_t level) noexcept {
+		timer list;
+		detach(level * level_slots + ((m_tick >> (level_bits * level)) & (level_slots - 1)), list);
+		while (list.m_next != &list) {
+			auto t = list.m_next;
+			t->unlink();
+			place(*t);
+		}
+		list.m_prev = list.m_next = nullptr;
+	}
+
+	uint64_t timer_wheel::next_tick() const noexcept {
+		auto res = UINT64_MAX;
+		for (size_t level = 0; level < level_count; level++) {
+			auto occupied = m_occupied[level];
+			if (occupied == 0) continue;
+			auto block = m_tick >> (level_bits * level);
+			// Rotate the slot following the current one to bit 0, the current slot itself is a full revolution away
+			auto shift = (block + 1) & (level_slots - 1);
+			if (shift != 0) occupied = (occupied >> shift) | (occupied << (level_slots - shift));
+			auto offset = static_cast<uint64_t>(__builtin_ctzll(occupied)) + 1;
+			res = std::min(res, (block + offset) << (level_bits * level));
+		}
+		return res;
+	}
+
+	void timer_wheel::schedule(timer& t, std::chrono::milliseconds delay, std::function<void()> fn, void* context) {
+		t.cancel();
+		auto ticks = (std::max<int64_t>(delay.count(), 0) + m_resolution.count() - 1) / m_resolution.count();
+		// Counted from the end of the current tick, so it never fires early
+		t.m_expires = std::max(tick_of(std::chrono::steady_clock::now()), m_tick) + 1 + static_cast<uint64_t>(ticks);
+		t.m_fn = std::move(fn);
+		t.m_context = context;
+		t.m_wheel = this;
+		place(t);
+		m_armed++;
+	}
+
+	bool timer_wheel::next_due(uint64_t target) noexcept {
+		if (m_tick >= target) return false;
+		// Jump straight to the next tick that has something to do
+		auto next = m_armed == 0 ? UINT64_MAX : next_tick();
+		if (next > target) {
+			m_tick = target;
+			return false;
+		}
+		m_tick = next;
+		// Coarse levels first, their timers may end up in the slots cascaded next
+		for (auto level = level_count - 1; level > 0; level--) {
+			if ((m_tick & ((uint64_t{1} << (level_bits * level)) - 1)) == 0) cascade(level);
+		}
+		return true;
+	}
+
+	std::chrono::steady_clock::time_point timer_wheel::next_expiry() const noexcept {
+		if (m_armed == 0) return std::chrono::steady_clock::time_point::max();
+		return m_start + m_resolution * static_cast<int64_t>(next_tick());
+	}
+
+	std::chrono::milliseconds timer_wheel::next_wakeup(std::chrono::steady_clock::time_point now) const noexcept {
+		if (m_armed == 0) return std::chrono::milliseconds::max();
+		auto due = next_expiry();
+		if (due <= now) return std::chrono::milliseconds{0};
+		return std::chrono::ceil<std::chrono::milliseconds>(due - now);
+	}
+} // namespace docker_plugin
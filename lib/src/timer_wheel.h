@@ -0,0 +1,137 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace docker_plugin {
+	class timer_wheel;
+
+	/**
+	 * \brief Intrusive timer entry, owned by whoever schedules it.
+	 * Destroying an armed timer cancels it.
+	 */
+	class timer {
+		timer(const timer&) = delete;
+		timer& operator=(const timer&) = delete;
+
+		timer_wheel* m_wheel{nullptr};
+		timer* m_prev{nullptr};
+		timer* m_next{nullptr};
+		uint64_t m_expires{0};
+		// Index of the slot the timer is linked into
+		uint32_t m_slot{0};
+		void* m_context{nullptr};
+		std::function<void()> m_fn{};
+		friend class timer_wheel;
+
+		void link_before(timer& pos) noexcept;
+		void unlink() noexcept;
+
+	public:
+		timer() = default;
+		~timer() { cancel(); }
+
+		bool armed() const noexcept { return m_next != nullptr; }
+		void cancel() noexcept;
+	};
+
+	/**
+	 * \brief Hierarchical timing wheel driven by the event loop.
+	 *
+	 * Four levels of 64 slots each, every level covering 64 times the range of the
+	 * one below. Timers are linked into the coarsest slot matching their distance
+	 * and moved down a level once the wheel reaches the start of that slot, so
+	 * scheduling and cancelling are O(1) and every timer is touched at most once
+	 * per level. A bitmap per level allows finding the next occupied slot without
+	 * visiting empty ones, which is used to skip idle ticks and to tell the event
+	 * loop how long it may sleep. Timers further out than the wheel covers are
+	 * parked in the last slot and placed again once it is reached.
+	 */
+	class timer_wheel {
+		timer_wheel(const timer_wheel&) = delete;
+		timer_wheel& operator=(const timer_wheel&) = delete;
+
+		static constexpr size_t level_bits = 6;
+		static constexpr size_t level_slots = size_t{1} << level_bits;
+		static constexpr size_t level_count = 4;
+
+		std::chrono::steady_clock::time_point m_start;
+		std::chrono::milliseconds m_resolution;
+		// Last tick that was processed
+		uint64_t m_tick{0};
+		size_t m_armed{0};
+		// Non empty slots per level
+		uint64_t m_occupied[level_count]{};
+		// List heads, empty lists point to themselves
+		timer m_slots[level_count * level_slots];
+		friend class timer;
+
+		uint64_t tick_of(std::chrono::steady_clock::time_point time) const noexcept;
+		void place(timer& t) noexcept;
+		void detach(size_t slot, timer& list) noexcept;
+		void cascade(size_t level) noexcept;
+		uint64_t next_tick() const noexcept;
+		/**
+		 * \brief Move on to the next tick with work up to target and cascade the coarser levels.
+		 * \return false if there is nothing left to do before target
+		 */
+		bool next_due(uint64_t target) noexcept;
+
+	public:
+		explicit timer_wheel(std::chrono::milliseconds resolution = std::chrono::milliseconds{1});
+		~timer_wheel();
+
+		std::chrono::milliseconds resolution() const noexcept { return m_resolution; }
+		bool empty() const noexcept { return m_armed == 0; }
+		/**
+		 * \brief Tick reached by the last call to advance(), a cheap coarse clock.
+		 */
+		uint64_t tick() const noexcept { return m_tick; }
+
+		/**
+		 * \brief Call fn once delay passed, rounded up to the resolution. Replaces a pending schedule of t.
+		 * context is handed to advance() along with fn.
+		 */
+		void schedule(timer& t, std::chrono::milliseconds delay, std::function<void()> fn, void* context = nullptr);
+
+		/**
+		 * \brief Call handler(context, fn) for all timers due at now. Handlers may schedule, cancel and destroy timers.
+		 * \return Number of timers fired
+		 */
+		template <typename TFn>
+		size_t advance(std::chrono::steady_clock::time_point now, TFn&& handler) {
+			size_t fired = 0;
+			auto target = tick_of(now);
+			while (next_due(target)) {
+				// Detach the slot, handlers may cancel or reschedule any timer in it
+				timer pending;
+				detach(m_tick & (level_slots - 1), pending);
+				while (pending.m_next != &pending) {
+					auto t = pending.m_next;
+					t->unlink();
+					if (t->m_expires > m_tick) {
+						place(*t);
+						continue;
+					}
+					// The handler may destroy the timer
+					auto fn = std::move(t->m_fn);
+					t->m_wheel = nullptr;
+					m_armed--;
+					fired++;
+					handler(t->m_context, fn);
+				}
+				pending.m_prev = pending.m_next = nullptr;
+			}
+			return fired;
+		}
+		/**
+		 * \brief Point in time at which advance() has work to do next, time_point::max() if no timer is armed.
+		 */
+		std::chrono::steady_clock::time_point next_expiry() const noexcept;
+		/**
+		 * \brief Time the event loop may sleep before advance() has work to do, max() if no timer is armed.
+		 */
+		std::chrono::milliseconds next_wakeup(std::chrono::steady_clock::time_point now) const noexcept;
+	};
+} // namespace docker_plugin
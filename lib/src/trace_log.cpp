@@ -0,0 +1,71 @@
+#include "trace_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace docker_plugin {
+	trace_log::trace_log(const std::string& path, size_t records) {
+		if (records == 0) throw std::system_error(std::make_error_code(std::errc::invalid_argument));
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0) throw std::system_error(errno, std::system_category(), "open " + path);
+		m_size = sizeof(trace_file_header) + records * sizeof(trace_record);
+		struct stat st {};
+		bool reuse = false;
+		if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == m_size) {
+			trace_file_header existing{};
+			reuse = ::pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) &&
+					memcmp(existing.magic, trace_file_header::magic_value(), sizeof(existing.magic)) == 0 &&
+					existing.version == trace_file_header::current_version && existing.record_size == sizeof(trace_record) &&
+					existing.capacity == records;
+		}
+		if (!reuse && (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, static_cast<off_t>(m_size)) != 0)) {
+			auto err = errno;
+			::close(fd);
+			throw std::system_error(err, std::system_category(), "truncate " + path);
+		}
+		m_map = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		auto err = errno;
+		::close(fd);
+		if (m_map == MAP_FAILED) throw std::system_error(err, std::system_category(), "mmap " + path);
+		m_header = static_cast<trace_file_header*>(m_map);
+		m_records = reinterpret_cast<trace_record*>(static_cast<char*>(m_map) + sizeof(trace_file_header));
+		if (!reuse) {
+			memcpy(m_header->magic, trace_file_header::magic_value(), sizeof(m_header->magic));
+			m_header->version = trace_file_header::current_version;
+			m_header->record_size = sizeof(trace_record);
+			m_header->capacity = records;
+			m_header->next = 0;
+		}
+	}
+
+	trace_log::~trace_log() {
+		::munmap(m_map, m_size);
+	}
+
+	void trace_log::write(std::string_view route, int fd, uint16_t status, uint32_t request_size, uint32_t response_size,
+						  uint64_t timestamp_ns, uint64_t duration_ns) noexcept {
+		auto idx = m_header->next;
+		auto& rec = m_records[idx % m_header->capacity];
+		// Readers skip the slot until the new sequence is in place. The fence keeps the field
+		// stores below from becoming visible before the zero, a release store alone doesn't.
+		__atomic_store_n(&rec.seq, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		rec.timestamp_ns = timestamp_ns;
+		rec.duration_ns = duration_ns;
+		rec.request_size = request_size;
+		rec.response_size = response_size;
+		rec.fd = fd;
+		rec.status = status;
+		rec.reserved = 0;
+		auto len = std::min(route.size(), sizeof(rec.route));
+		memcpy(rec.route, route.data(), len);
+		memset(rec.route + len, 0, sizeof(rec.route) - len);
+		__atomic_store_n(&rec.seq, idx + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&m_header->next, idx + 1, __ATOMIC_RELEASE);
+	}
+} // namespace docker_plugin
@@ -0,0 +1,35 @@
+#pragma once
+#include "docker-plugin-cpp/trace.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace docker_plugin {
+	/**
+	 * \brief Writer for the memory mapped request trace ring.
+	 *
+	 * Only the event loop writes, readers may look at the file at any time and
+	 * use the record sequence numbers to skip records that are being overwritten.
+	 * An existing file with a matching layout is continued instead of cleared.
+	 */
+	class trace_log {
+		trace_log(const trace_log&) = delete;
+		trace_log& operator=(const trace_log&) = delete;
+
+		void* m_map{nullptr};
+		size_t m_size{0};
+		trace_file_header* m_header{nullptr};
+		trace_record* m_records{nullptr};
+
+	public:
+		/**
+		 * \brief Open or create the trace file at path, holding records entries.
+		 * Throws std::system_error on failure.
+		 */
+		trace_log(const std::string& path, size_t records);
+		~trace_log();
+
+		void write(std::string_view route, int fd, uint16_t status, uint32_t request_size, uint32_t response_size,
+				   uint64_t timestamp_ns, uint64_t duration_ns) noexcept;
+	};
+} // namespace docker_plugin
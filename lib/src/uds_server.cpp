@@ -1,49 +1,184 @@
 #include "uds_server.h"
+#include "completion_queue.h"
 #include "docker-plugin-cpp/logger.h"
+#include "poller.h"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 namespace docker_plugin {
 
+	void connection_handle::post(std::function<void()> fn) const {
+		if (m_queue) m_queue->push(m_con, m_generation, std::move(fn));
+	}
+
+	void connection_handle::post_unbound(std::function<void()> fn) const {
+		if (m_queue) m_queue->push(std::move(fn));
+	}
+
 	uds_connection::~uds_connection() {
 		if (m_socket >= 0) ::close(m_socket);
 	}
 
 	void uds_connection::close() {
-		if (m_socket >= 0) ::close(m_socket);
+		if (m_socket < 0) return;
+		if (m_server && has_output()) {
+			// Keep the socket around until the queued response is sent
+			m_closing = true;
+			update_interest();
+			return;
+		}
+		release();
+	}
+
+	void uds_connection::release() {
+		if (m_socket >= 0) {
+			if (m_server) m_server->m_poller->remove(m_socket);
+			::close(m_socket);
+		}
 		m_socket = -1;
 	}
 
 	size_t uds_connection::write(const void* data, size_t len) {
-		if (m_socket < 0) return SIZE_MAX;
-		if (m_server->m_logger) m_server->m_logger->log(logger::level::debug, "[" + std::to_string(m_socket) + "] out " + std::to_string(len) + " bytes");
-		auto ptr = reinterpret_cast<const uint8_t*>(data);
-		auto remaining = len;
-		while (remaining > 0) {
-			int res = send(m_socket, ptr, remaining, 0);
-			if (res < 0) return SIZE_MAX;
-			remaining -= res;
-			ptr += res;
+		struct iovec iov {
+			const_cast<void*>(data), len
+		};
+		return writev(&iov, 1);
+	}
+
+	size_t uds_connection::writev(const iovec* iov, size_t count) {
+		if (m_socket < 0 || m_closing) return SIZE_MAX;
+		size_t len = 0;
+		for (size_t i = 0; i < count; i++)
+			len += iov[i].iov_len;
+		if (m_server->should_log(logger::level::debug)) m_server->log(logger::level::debug, "[" + std::to_string(m_socket) + "] out " + std::to_string(len) + " bytes");
+		size_t sent = 0;
+		if (!has_output()) {
+			sent = m_server->m_poller->sendv(m_socket, iov, count);
+			if (sent == SIZE_MAX) return SIZE_MAX;
 		}
+		// Queue whatever the socket did not take
+		for (size_t i = 0; i < count; i++) {
+			if (sent >= iov[i].iov_len) {
+				sent -= iov[i].iov_len;
+				continue;
+			}
+			m_output.append(static_cast<const char*>(iov[i].iov_base) + sent, iov[i].iov_len - sent);
+			sent = 0;
+		}
+		update_backpressure();
 		return len;
 	}
 
-	uds_server::uds_server(logger* log)
-		: m_logger{log} {}
+	size_t uds_connection::queued_output() const noexcept {
+		auto res = m_output.size() - m_output_offset;
+		if (m_socket >= 0) res += m_server->m_poller->pending(m_socket);
+		return res;
+	}
+
+	const connection_timeouts& uds_connection::timeouts() const noexcept {
+		static const connection_timeouts none{std::chrono::milliseconds{0}, std::chrono::milliseconds{0}, std::chrono::milliseconds{0}};
+		return m_server ? m_server->m_timeouts : none;
+	}
+
+	connection_handle uds_connection::handle() {
+		if (m_server == nullptr) return {};
+		return {m_server->m_completions, m_self, m_generation};
+	}
+
+	void uds_connection::schedule(timer& t, std::chrono::milliseconds delay, std::function<void()> fn) {
+		if (m_server == nullptr) return;
+		m_server->m_timers.schedule(t, delay, std::move(fn), this);
+	}
+
+	bool uds_connection::reset() {
+		m_output.clear();
+		m_output_offset = 0;
+		m_interest = 0;
+		m_read_paused = false;
+		m_input_paused = false;
+		m_closing = false;
+		m_idle_timer.cancel();
+		m_generation++;
+		return false;
+	}
+
+	bool uds_connection::flush() {
+		if (has_output()) {
+			auto res = m_server->m_poller->send(m_socket, m_output.data() + m_output_offset, m_output.size() - m_output_offset);
+			if (res == SIZE_MAX) return false;
+			m_output_offset += res;
+			if (m_output_offset == m_output.size()) {
+				m_output.clear();
+				m_output_offset = 0;
+			}
+		}
+		update_backpressure();
+		return true;
+	}
+
+	void uds_connection::update_backpressure() {
+		auto queued = queued_output();
+		bool resumed = false;
+		if (!m_read_paused && queued > m_server->m_high_watermark) {
+			m_read_paused = true;
+		} else if (m_read_paused && queued <= m_server->m_low_watermark) {
+			m_read_paused = false;
+			resumed = true;
+		}
+		update_interest();
+		if (resumed && !m_closing) on_drain();
+	}
+
+	void uds_connection::pause_input(bool paused) {
+		if (m_input_paused == paused) return;
+		m_input_paused = paused;
+		update_interest();
+	}
+
+	void uds_connection::update_interest() {
+		uint32_t interest = 0;
+		if (!m_read_paused && !m_input_paused && !m_closing) interest |= poller::readable;
+		if (has_output() || m_read_paused) interest |= poller::writable;
+		if (interest == m_interest || m_socket < 0) return;
+		m_interest = interest;
+		m_server->m_poller->modify(m_socket, interest, this);
+	}
+
+	uds_server::uds_server(logger* log, io_backend backend)
+		: m_logger{log}, m_poller{poller::create(backend)}, m_completions{std::make_shared<completion_queue>()} {
+		// Tagged with the queue itself to tell it apart from connections
+		auto err = m_poller->add(m_completions->get_fd(), poller::readable, m_completions.get());
+		if (err != 0) throw std::system_error(err, std::system_category());
+	}
 
 	uds_server::~uds_server() {
-		if (m_socket >= 0)
-		{
-			::close(m_socket);
+		for (auto& e : m_listeners) {
+			m_poller->remove(e->fd);
+			::close(e->fd);
+		}
+		m_poller->remove(m_completions->get_fd());
+		if (m_timer_fd >= 0) {
+			m_poller->remove(m_timer_fd);
+			::close(m_timer_fd);
+		}
+		for (auto& e : m_connections) {
+			e->release();
 		}
 	}
 
 	void uds_server::bind(const std::string& path, std::error_code& ec) {
+		bind(path, nullptr, ec);
+	}
+
+	void uds_server::bind(const std::string& path, connection_factory factory, std::error_code& ec) {
 		struct sockaddr_un addr {};
 		addr.sun_family = AF_LOCAL;
 		if (path.size() > sizeof(addr.sun_path))
@@ -65,77 +200,259 @@ namespace docker_plugin {
 			::close(s);
 			return;
 		}
-		m_socket = s;
+		// Listening sockets are tagged with their listener, connections use their address
+		auto l = std::make_unique<listener>(listener{s, std::move(factory)});
+		auto err = m_poller->add_listener(s, l.get());
+		if (err != 0)
+		{
+			ec = std::error_code(err, std::system_category());
+			::close(s);
+			return;
+		}
+		m_listeners.emplace_back(std::move(l));
 		ec.clear();
 	}
 
 	int uds_server::run(size_t timeout_ms) {
-		fd_set set;
-		FD_ZERO(&set);
-		FD_SET(m_socket, &set);
-		auto max = m_socket;
-		for (auto& e : m_connections) {
-			FD_SET(e->get_fd(), &set);
-			max = std::max(max, e->get_fd());
-		}
-		struct timeval tv {};
-		tv.tv_sec = timeout_ms / 1000;
-		tv.tv_usec = (timeout_ms % 1000) * 1000;
-		auto res = select(max + 1, &set, NULL, NULL, &tv);
+		poller::event events[64];
+		auto wakeup = m_timers.next_wakeup(std::chrono::steady_clock::now());
+		timeout_ms = std::min<size_t>(timeout_ms, static_cast<size_t>(std::min<std::chrono::milliseconds::rep>(wakeup.count(), INT32_MAX)));
+		auto res = m_poller->wait(events, 64, static_cast<int>(std::min<size_t>(timeout_ms, INT32_MAX)));
 		if (res < 0) return errno;
-		if (res == 0) return 0;
-		if (FD_ISSET(m_socket, &set)) {
-			struct sockaddr_storage address;
-			socklen_t addrlen;
-			int new_sock = accept4(m_socket, reinterpret_cast<struct sockaddr*>(&address), &addrlen, SOCK_CLOEXEC);
-			if (new_sock != -1) {
-				auto con = this->create_connection(new_sock);
-				if (con) {
-					con->m_server = this;
-					this->on_connect(con);
-					log(logger::level::debug, "New socket " + std::to_string(new_sock));
-					bool closed = handle_io(*con);
-					if (closed) {
-						log(logger::level::debug, "Closed socket " + std::to_string(new_sock));
-						this->on_disconnect(con);
-					} else
-						m_connections.emplace_back(con);
-				} else
-					::close(new_sock);
+		bool completions = false;
+		for (int i = 0; i < res; i++) {
+			auto& ev = events[i];
+			if (auto l = find_listener(ev.data)) {
+				if (ev.events & poller::accepted)
+					add_connection(*l, ev.result);
+				else if (ev.events & poller::readable)
+					accept_connections(*l);
+				continue;
 			}
-		}
-		for (auto it = m_connections.begin(); it != m_connections.end();) {
-			auto fd = (*it)->get_fd();
-			if (FD_ISSET(fd, &set)) {
-				auto closed = handle_io(*it->get());
-				if (closed) {
-					log(logger::level::debug, "Closed socket " + std::to_string(fd));
-					this->on_disconnect(*it);
-					it = m_connections.erase(it);
-					continue;
+			if (ev.data == m_completions.get()) {
+				completions = true;
+				continue;
+			}
+			if (ev.data == &m_timer_fd) {
+				// Only resets readiness, due timers are run below anyway
+				uint64_t expirations;
+				if (::read(m_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) m_timer_fd_expiry = {};
+				continue;
+			}
+			auto con = static_cast<uds_connection*>(ev.data);
+			auto fd = con->get_fd();
+			if (handle_event(*con, ev.events, ev.buffer, ev.length)) {
+				close_connection(con, fd);
+				// Completion based pollers can report the same connection more than once per batch
+				for (int j = i + 1; j < res; j++) {
+					if (events[j].data == con) events[j].events = 0;
 				}
 			}
-			it++;
 		}
+		// Run after the batch, posted functions may close connections that still have events in it
+		if (completions) run_completions();
+		m_timers.advance(std::chrono::steady_clock::now(), [this](void* con, const std::function<void()>& fn) {
+			if (con)
+				run_on(*static_cast<uds_connection*>(con), fn);
+			else
+				fn();
+		});
 		return 0;
 	}
 
+	int uds_server::get_fd() {
+		auto fd = m_poller->get_fd();
+		if (fd < 0 || m_timer_fd >= 0) return fd;
+		m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (m_timer_fd < 0) return -1;
+		if (m_poller->add(m_timer_fd, poller::readable, &m_timer_fd) != 0) {
+			::close(m_timer_fd);
+			m_timer_fd = -1;
+			return -1;
+		}
+		update_timer_fd();
+		m_poller->submit();
+		return fd;
+	}
+
+	int uds_server::process_ready() {
+		auto res = run(0);
+		if (m_timer_fd >= 0) update_timer_fd();
+		m_poller->submit();
+		return res;
+	}
+
+	void uds_server::update_timer_fd() {
+		auto expiry = m_timers.next_expiry();
+		if (expiry == m_timer_fd_expiry) return;
+		m_timer_fd_expiry = expiry;
+		// steady_clock is CLOCK_MONOTONIC, a zero it_value disarms the timer
+		struct itimerspec spec {};
+		if (expiry != std::chrono::steady_clock::time_point::max()) {
+			auto ns = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(expiry.time_since_epoch()).count(), 1);
+			spec.it_value.tv_sec = ns / 1000000000;
+			spec.it_value.tv_nsec = ns % 1000000000;
+		}
+		timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+	}
+
+	void uds_server::run_completions() {
+		m_completions->drain([this](const std::weak_ptr<uds_connection>& ptr, uint32_t generation, const std::function<void()>& fn) {
+			auto con = ptr.lock();
+			// Meant for an earlier socket served by the same object
+			if (con && con->m_generation == generation) run_on(*con, fn);
+		});
+	}
+
+	void uds_server::run_on(uds_connection& con, const std::function<void()>& fn) {
+		// Keeps con alive even if fn closes it
+		auto ptr = con.m_self.lock();
+		// Nobody is waiting for the result anymore
+		if (!ptr || con.get_fd() < 0 || con.m_closing) return;
+		auto fd = con.get_fd();
+		fn();
+		if (con.get_fd() >= 0 && !con.m_closing) con.on_posted();
+		if (con.get_fd() < 0 || con.m_closing) close_connection(&con, fd);
+	}
+
+	void uds_server::arm_idle(uds_connection& con, std::chrono::milliseconds delay) {
+		con.schedule(con.m_idle_timer, delay, [this, &con]() { check_idle(con); });
+	}
+
+	void uds_server::check_idle(uds_connection& con) {
+		auto idle = m_timeouts.idle;
+		if (idle.count() <= 0) return;
+		// Input only records the tick, the timer catches up with it lazily
+		auto elapsed = m_timers.resolution() * static_cast<int64_t>(m_timers.tick() - con.m_active_tick);
+		if (elapsed < idle) return arm_idle(con, idle - elapsed);
+		if (con.busy()) return arm_idle(con, idle);
+		if (should_log(logger::level::debug)) log(logger::level::debug, "Idle timeout on socket " + std::to_string(con.get_fd()));
+		con.close();
+	}
+
+	uds_server::listener* uds_server::find_listener(const void* tag) const noexcept {
+		for (auto& e : m_listeners) {
+			if (e.get() == tag) return e.get();
+		}
+		return nullptr;
+	}
+
+	void uds_server::accept_connections(const listener& l) {
+		while (true) {
+			struct sockaddr_storage address;
+			socklen_t addrlen = sizeof(address);
+			int new_sock = accept4(l.fd, reinterpret_cast<struct sockaddr*>(&address), &addrlen, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (new_sock == -1) return;
+			add_connection(l, new_sock);
+		}
+	}
+
+	void uds_server::add_connection(const listener& l, int fd) {
+		if (!l.factory && m_max_connections != 0 && m_primary_connections >= m_max_connections) {
+			// Fresh socket, the response fits into its buffer
+			if (!m_reject_response.empty()) ::send(fd, m_reject_response.data(), m_reject_response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+			::close(fd);
+			m_rejected++;
+			if (should_log(logger::level::debug)) log(logger::level::debug, "Rejected socket " + std::to_string(fd) + ", connection limit reached");
+			return;
+		}
+		std::shared_ptr<uds_connection> con;
+		if (l.factory) {
+			con = l.factory(fd);
+		} else if (!m_pool.empty()) {
+			con = std::move(m_pool.back());
+			m_pool.pop_back();
+			con->m_socket = fd;
+		} else {
+			con = this->create_connection(fd);
+		}
+		if (!con) {
+			::close(fd);
+			return;
+		}
+		auto err = m_poller->add_stream(fd, con.get());
+		if (err != 0) {
+			if (should_log(logger::level::warning)) log(logger::level::warning, "Failed to watch socket " + std::to_string(fd) + ": " + std::error_code(err, std::system_category()).message());
+			return;
+		}
+		con->m_server = this;
+		con->m_self = con;
+		con->m_interest = poller::readable;
+		con->m_primary = !l.factory;
+		con->m_active_tick = m_timers.tick();
+		if (m_timeouts.idle.count() > 0) arm_idle(*con, m_timeouts.idle);
+		if (con->m_primary) {
+			m_primary_connections++;
+			this->on_connect(con);
+		}
+		if (should_log(logger::level::debug)) log(logger::level::debug, "New socket " + std::to_string(fd));
+		con->m_index = m_connections.size();
+		m_connections.emplace_back(std::move(con));
+	}
+
+	void uds_server::close_connection(uds_connection* con, int fd) {
+		// Lingering until the remaining output is flushed
+		if (con->m_closing && con->get_fd() >= 0 && con->has_output()) return;
+		if (should_log(logger::level::debug)) log(logger::level::debug, "Closed socket " + std::to_string(fd));
+		// Closed twice, e.g. by a handler and the event that follows
+		if (con->m_index >= m_connections.size() || m_connections[con->m_index].get() != con) return;
+		// Swap with the last slot, the order of m_connections carries no meaning
+		auto ptr = std::move(m_connections[con->m_index]);
+		if (con->m_index != m_connections.size() - 1) {
+			m_connections[con->m_index] = std::move(m_connections.back());
+			m_connections[con->m_index]->m_index = con->m_index;
+		}
+		m_connections.pop_back();
+		ptr->release();
+		if (ptr->m_primary) {
+			m_primary_connections--;
+			this->on_disconnect(ptr);
+			// Only reused if nothing but handles refer to it anymore, those are told apart by the generation
+			if (ptr.use_count() == 1 && m_pool.size() < pool_limit && ptr->reset()) m_pool.emplace_back(std::move(ptr));
+		}
+	}
+
+	bool uds_server::should_log(log_level lvl) const noexcept {
+		return m_logger != nullptr && m_logger->should_log(lvl);
+	}
+
 	void uds_server::log(log_level lvl, const std::string& msg) {
 		if (m_logger) m_logger->log(lvl, msg);
 	}
 
+	bool uds_server::handle_event(uds_connection& con, uint32_t events, const void* buffer, size_t length) {
+		if (events & poller::writable) {
+			if (!con.flush() || con.get_fd() < 0) return true;
+		}
+		if (con.m_closing) {
+			// Only waiting for queued output to drain
+			return (events & poller::hangup) || !con.has_output();
+		}
+		if (events & poller::received) return handle_read(con, buffer, length);
+		if (events & poller::readable) return handle_io(con);
+		return (events & poller::hangup) != 0;
+	}
+
 	bool uds_server::handle_io(uds_connection& con) {
 		char buffer[32 * 1024];
 		int res = recv(con.get_fd(), buffer, sizeof(buffer), MSG_DONTWAIT);
-		if (res == 0) return true;
+		if (res == 0) {
+			con.close();
+			return true;
+		}
 		if (res < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return false;
-			con.close();
+			con.release();
 			return true;
 		}
-		log(logger::level::debug, "[" + std::to_string(con.get_fd()) + "] in " + std::to_string(res) + " bytes");
-		con.on_read(buffer, res);
-		return con.get_fd() < 0;
+		return handle_read(con, buffer, res);
+	}
+
+	bool uds_server::handle_read(uds_connection& con, const void* data, size_t len) {
+		if (should_log(logger::level::debug)) log(logger::level::debug, "[" + std::to_string(con.get_fd()) + "] in " + std::to_string(len) + " bytes");
+		con.m_active_tick = m_timers.tick();
+		con.on_read(data, len);
+		return con.get_fd() < 0 || con.m_closing;
 	}
 
 } // namespace docker_plugin
\ No newline at end of file
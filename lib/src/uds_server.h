@@ -1,4 +1,8 @@
 #pragma once
+#include "timer_wheel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <set>
@@ -6,10 +10,53 @@
 #include <system_error>
 #include <vector>
 
+struct iovec;
+
 namespace docker_plugin {
 	class uds_server;
+	class uds_connection;
 	class logger;
+	class poller;
+	class completion_queue;
 	enum class log_level;
+	enum class io_backend;
+
+	/**
+	 * \brief Limits for connections that stop making progress, zero disables a limit.
+	 */
+	struct connection_timeouts {
+		// Without any input while no response is outstanding
+		std::chrono::milliseconds idle{std::chrono::seconds{60}};
+		// From the first byte of a request until its headers are complete
+		std::chrono::milliseconds header{std::chrono::seconds{10}};
+		// From the end of the headers until the request is complete
+		std::chrono::milliseconds body{std::chrono::seconds{30}};
+	};
+
+	/**
+	 * \brief Thread safe reference to a connection, used to get back onto the event loop.
+	 */
+	class connection_handle {
+		std::shared_ptr<completion_queue> m_queue{};
+		std::weak_ptr<uds_connection> m_con{};
+		uint32_t m_generation{0};
+
+	public:
+		connection_handle() = default;
+		connection_handle(std::shared_ptr<completion_queue> queue, std::weak_ptr<uds_connection> con, uint32_t generation)
+			: m_queue{std::move(queue)}, m_con{std::move(con)}, m_generation{generation} {}
+
+		/**
+		 * \brief Call fn on the event loop, unless the connection was closed in the meantime.
+		 * Can be called from any thread, including after the server was destroyed.
+		 */
+		void post(std::function<void()> fn) const;
+		/**
+		 * \brief Call fn on the event loop, even if the connection was closed in the meantime.
+		 * Can be called from any thread, fn is dropped if the server was destroyed.
+		 */
+		void post_unbound(std::function<void()> fn) const;
+	};
 
 	class uds_connection {
 		uds_connection(const uds_connection&) = delete;
@@ -19,14 +66,92 @@ namespace docker_plugin {
 
 		int m_socket;
 		uds_server* m_server;
+		std::weak_ptr<uds_connection> m_self{};
+		// Output not yet accepted by the kernel, sent once the socket becomes writable
+		std::string m_output{};
+		size_t m_output_offset{0};
+		uint32_t m_interest{0};
+		bool m_read_paused{false};
+		// Set by pause_input(), independent of the output watermarks
+		bool m_input_paused{false};
+		bool m_closing{false};
+		// Created by create_connection(), reported to on_connect() and on_disconnect()
+		bool m_primary{true};
+		timer m_idle_timer{};
+		// Wheel tick of the last input
+		uint64_t m_active_tick{0};
+		// Slot in uds_server::m_connections
+		size_t m_index{0};
+		// Bumped whenever the object is reused for another socket, handles of earlier ones are ignored
+		uint32_t m_generation{0};
 		friend class uds_server;
 
+		bool has_output() const noexcept { return m_output_offset < m_output.size(); }
+		bool flush();
+		void release();
+		void update_backpressure();
+		void update_interest();
+
 	protected:
 		int get_fd() const noexcept { return m_socket; }
 
+		/**
+		 * \brief Send data to the peer without blocking.
+		 * Whatever the socket does not accept right away is queued and
+		 * sent once it becomes writable.
+		 * \return len or SIZE_MAX if the connection is broken.
+		 */
 		size_t write(const void* data, size_t len);
+		/**
+		 * \brief Send a list of buffers to the peer with a single syscall.
+		 * Behaves like write() called for each buffer in order.
+		 * \return Total number of bytes or SIZE_MAX if the connection is broken.
+		 */
+		size_t writev(const iovec* iov, size_t count);
+		/**
+		 * \brief Close the connection once all queued output is sent.
+		 */
 		void close();
+		/**
+		 * \brief Check if queued output exceeded the high watermark.
+		 * Reading from the socket is paused until it drops below the low watermark.
+		 */
+		bool write_blocked() const noexcept { return m_read_paused; }
+		/**
+		 * \brief Stop or resume reading from the socket, e.g. while received input can't be processed.
+		 * Reading continues only once neither this nor write_blocked() holds it back.
+		 */
+		void pause_input(bool paused);
+		size_t queued_output() const noexcept;
+		const connection_timeouts& timeouts() const noexcept;
+		/**
+		 * \brief Check if the connection waits for something other than input, which keeps it from timing out as idle.
+		 */
+		virtual bool busy() const noexcept { return has_output(); }
+		/**
+		 * \brief Get a handle to complete work for this connection from other threads.
+		 */
+		connection_handle handle();
 		virtual void on_read(const void* data, size_t len) = 0;
+		/**
+		 * \brief Called once queued output dropped below the low watermark after write_blocked() was set.
+		 */
+		virtual void on_drain() {}
+		/**
+		 * \brief Call fn on the event loop once delay passed, unless t is cancelled or destroyed first.
+		 * t is usually a member of the connection, timers of closed connections don't fire.
+		 */
+		void schedule(timer& t, std::chrono::milliseconds delay, std::function<void()> fn);
+		/**
+		 * \brief Called on the event loop after a function posted using a connection_handle or a timer ran.
+		 */
+		virtual void on_posted() {}
+		/**
+		 * \brief Clear all per socket state of a closed connection, keeping allocated buffers.
+		 * Overrides need to call the base implementation. Only connections returning true are kept
+		 * for reuse with the next accepted socket, the base implementation returns false.
+		 */
+		virtual bool reset();
 
 	public:
 		uds_connection(int sock) : m_socket{sock}, m_server{nullptr} {}
@@ -39,13 +164,57 @@ namespace docker_plugin {
 		uds_server& operator=(const uds_server&) = delete;
 		uds_server& operator=(uds_server&&) = delete;
 
-		int m_socket{-1};
+	public:
+		using connection_factory = std::function<std::shared_ptr<uds_connection>(int socket)>;
+
+	private:
+		struct listener {
+			int fd;
+			// Creates the connections accepted on this socket, create_connection() if empty
+			connection_factory factory;
+		};
+
+		// Polled with the listener as tag, the list is short enough for a linear scan
+		std::vector<std::unique_ptr<listener>> m_listeners{};
 		logger* m_logger{};
+		std::unique_ptr<poller> m_poller;
+		// Shared with connection handles, which may outlive the server
+		std::shared_ptr<completion_queue> m_completions;
+		size_t m_low_watermark{256 * 1024};
+		size_t m_high_watermark{1024 * 1024};
+		connection_timeouts m_timeouts{};
+		// Connections from create_connection(), limited to m_max_connections unless zero
+		size_t m_primary_connections{0};
+		size_t m_max_connections{0};
+		// Sent as is to connections over the limit before closing them
+		std::string m_reject_response{};
+		uint64_t m_rejected{0};
+		// Closed connections from create_connection() kept for reuse, most recently closed last
+		std::vector<std::shared_ptr<uds_connection>> m_pool{};
+		static constexpr size_t pool_limit = 64;
+		// Only used while embedded into another event loop, signals due timers through the poller
+		int m_timer_fd{-1};
+		std::chrono::steady_clock::time_point m_timer_fd_expiry{};
+		// Declared before the connections, whose timers unlink themselves on destruction
+		timer_wheel m_timers{};
 		std::vector<std::shared_ptr<uds_connection>> m_connections{};
 		friend class uds_connection;
 
+		// Check before building a message, disabled levels should cost nothing
+		bool should_log(log_level lvl) const noexcept;
 		void log(log_level lvl, const std::string& msg);
+		bool handle_event(uds_connection& con, uint32_t events, const void* buffer, size_t length);
 		bool handle_io(uds_connection& con);
+		bool handle_read(uds_connection& con, const void* data, size_t len);
+		void run_completions();
+		void run_on(uds_connection& con, const std::function<void()>& fn);
+		void arm_idle(uds_connection& con, std::chrono::milliseconds delay);
+		void update_timer_fd();
+		void check_idle(uds_connection& con);
+		listener* find_listener(const void* tag) const noexcept;
+		void accept_connections(const listener& l);
+		void add_connection(const listener& l, int fd);
+		void close_connection(uds_connection* con, int fd);
 
 	protected:
 		virtual void on_connect(const std::shared_ptr<uds_connection>&) = 0;
@@ -53,11 +222,55 @@ namespace docker_plugin {
 		virtual std::shared_ptr<uds_connection> create_connection(int socket) = 0;
 
 	public:
-		uds_server(logger* log);
+		uds_server(logger* log, io_backend backend);
 		virtual ~uds_server();
 
 		void bind(const std::string& path, std::error_code& ec);
+		/**
+		 * \brief Listen on an additional socket whose connections are created by factory.
+		 * on_connect() and on_disconnect() are not called for these connections.
+		 */
+		void bind(const std::string& path, connection_factory factory, std::error_code& ec);
+
+		/**
+		 * \brief Set the amount of queued output per connection at which reading is paused (high)
+		 * and resumed again (low).
+		 */
+		void set_write_watermarks(size_t low, size_t high) noexcept {
+			m_low_watermark = low;
+			m_high_watermark = std::max(low, high);
+		}
 
+		void set_timeouts(const connection_timeouts& timeouts) noexcept { m_timeouts = timeouts; }
+
+		/**
+		 * \brief Limit the number of connections created by create_connection(), zero means unlimited.
+		 * Connections over the limit are sent response and closed right away, without reading from them.
+		 */
+		void set_connection_limit(size_t max, std::string response) {
+			m_max_connections = max;
+			m_reject_response = std::move(response);
+		}
+		uint64_t rejected_connections() const noexcept { return m_rejected; }
+
+		/**
+		 * \brief Call fn from within run() once delay passed, unless t is cancelled or destroyed first.
+		 */
+		void schedule(timer& t, std::chrono::milliseconds delay, std::function<void()> fn) { m_timers.schedule(t, delay, std::move(fn)); }
+
+		/**
+		 * \brief Wait for and handle events, returning early once the next timer is due.
+		 */
 		int run(size_t timeout_ms);
+
+		/**
+		 * \brief Get a file descriptor that is readable whenever process_ready() has work to do.
+		 * \return The fd or -1 if the backend does not support it, or if setting it up failed.
+		 */
+		int get_fd();
+		/**
+		 * \brief Handle everything that is ready without blocking, for use with get_fd().
+		 */
+		int process_ready();
 	};
 } // namespace docker_plugin
\ No newline at end of file
@@ -0,0 +1,508 @@
+#include "uring_poller.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace docker_plugin {
+	namespace {
+		enum op : uint8_t {
+			op_accept = 1,
+			op_recv = 2,
+			op_send = 3,
+			op_poll = 4,
+			op_cancel = 5,
+			// Only makes the ring readable for an outer event loop
+			op_wakeup = 6
+		};
+
+		uint64_t make_user_data(uint64_t id, op o) { return (id << 8) | o; }
+
+		template <typename T>
+		T* offset_ptr(void* base, size_t offset) {
+			return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+		}
+
+		std::system_error last_error() {
+			return std::system_error(std::error_code(errno, std::system_category()));
+		}
+
+		uint32_t to_poll_events(uint32_t events) {
+			uint32_t res = 0;
+			if (events & poller::readable) res |= POLLIN | POLLRDHUP;
+			if (events & poller::writable) res |= POLLOUT;
+			return res;
+		}
+	} // namespace
+
+	uring_poller::uring_poller() {
+		struct io_uring_params params {};
+		params.flags = IORING_SETUP_CLAMP;
+		m_ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, ring_entries, &params));
+		if (m_ring_fd < 0) throw last_error();
+		// Everything below relies on the single mmap layout and timeouts passed to io_uring_enter
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+			::close(m_ring_fd);
+			throw std::system_error(std::make_error_code(std::errc::not_supported));
+		}
+
+		m_ring_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+									   params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		m_ring_ptr = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+		if (m_ring_ptr == MAP_FAILED) {
+			auto err = last_error();
+			::close(m_ring_fd);
+			throw err;
+		}
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		auto sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			auto err = last_error();
+			munmap(m_ring_ptr, m_ring_size);
+			::close(m_ring_fd);
+			throw err;
+		}
+		m_sqes = static_cast<io_uring_sqe*>(sqes);
+		m_sq_head = offset_ptr<unsigned>(m_ring_ptr, params.sq_off.head);
+		m_sq_tail = offset_ptr<unsigned>(m_ring_ptr, params.sq_off.tail);
+		m_sq_mask = *offset_ptr<unsigned>(m_ring_ptr, params.sq_off.ring_mask);
+		m_sq_entries = params.sq_entries;
+		m_sq_local_tail = *m_sq_tail;
+		// SQEs are always used in order, so the indirection array is an identity mapping
+		auto sq_array = offset_ptr<unsigned>(m_ring_ptr, params.sq_off.array);
+		for (unsigned i = 0; i < m_sq_entries; i++)
+			sq_array[i] = i;
+		m_cq_head = offset_ptr<unsigned>(m_ring_ptr, params.cq_off.head);
+		m_cq_tail = offset_ptr<unsigned>(m_ring_ptr, params.cq_off.tail);
+		m_cq_mask = *offset_ptr<unsigned>(m_ring_ptr, params.cq_off.ring_mask);
+		m_cqes = offset_ptr<io_uring_cqe>(m_ring_ptr, params.cq_off.cqes);
+
+		// Provided buffer ring used by recv
+		m_buf_ring_size = buffer_count * sizeof(io_uring_buf);
+		auto buf_ring = mmap(nullptr, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf_ring == MAP_FAILED) {
+			auto err = last_error();
+			munmap(m_sqes, m_sqes_size);
+			munmap(m_ring_ptr, m_ring_size);
+			::close(m_ring_fd);
+			throw err;
+		}
+		m_buf_ring = static_cast<io_uring_buf_ring*>(buf_ring);
+		struct io_uring_buf_reg reg {};
+		reg.ring_addr = reinterpret_cast<uint64_t>(m_buf_ring);
+		reg.ring_entries = buffer_count;
+		reg.bgid = 0;
+		if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+			auto err = last_error();
+			munmap(m_buf_ring, m_buf_ring_size);
+			munmap(m_sqes, m_sqes_size);
+			munmap(m_ring_ptr, m_ring_size);
+			::close(m_ring_fd);
+			throw err;
+		}
+		m_buffers.reset(new char[buffer_count * buffer_size]);
+		for (unsigned i = 0; i < buffer_count; i++)
+			recycle_buffer(static_cast<uint16_t>(i));
+		publish_buffers();
+	}
+
+	uring_poller::~uring_poller() {
+		struct io_uring_buf_reg reg {};
+		reg.bgid = 0;
+		syscall(__NR_io_uring_register, m_ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		::close(m_ring_fd);
+		munmap(m_buf_ring, m_buf_ring_size);
+		munmap(m_sqes, m_sqes_size);
+		munmap(m_ring_ptr, m_ring_size);
+		for (auto& e : m_registrations) {
+			if (e.second.orphaned) ::close(e.second.fd);
+		}
+	}
+
+	io_uring_sqe* uring_poller::get_sqe() {
+		if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) {
+			// Queue is full, hand the current batch to the kernel to make room
+			enter(0, 0);
+			if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) return nullptr;
+		}
+		auto sqe = &m_sqes[m_sq_local_tail & m_sq_mask];
+		m_sq_local_tail++;
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	int uring_poller::enter(unsigned wait_nr, int timeout_ms) {
+		__atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+		auto to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+		unsigned flags = 0;
+		struct __kernel_timespec ts {};
+		struct io_uring_getevents_arg arg {};
+		if (wait_nr != 0) {
+			flags |= IORING_ENTER_GETEVENTS;
+			if (timeout_ms >= 0) {
+				ts.tv_sec = timeout_ms / 1000;
+				ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+				arg.sigmask_sz = _NSIG / 8;
+				arg.ts = reinterpret_cast<uint64_t>(&ts);
+				flags |= IORING_ENTER_EXT_ARG;
+			}
+		} else if (to_submit == 0)
+			return 0;
+		auto res = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, wait_nr, flags, (flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr, sizeof(arg));
+		if (res < 0) {
+			// Timeouts and a full completion queue are not errors, the caller just reaps what is there
+			if (errno == ETIME || errno == EBUSY || errno == EAGAIN) return 0;
+			return -1;
+		}
+		return 0;
+	}
+
+	void uring_poller::recycle_buffer(uint16_t bid) {
+		// Not using m_buf_ring->bufs, the flexible array member is misplaced by C++ compilers
+		auto& buf = reinterpret_cast<io_uring_buf*>(m_buf_ring)[m_buf_tail & (buffer_count - 1)];
+		buf.addr = reinterpret_cast<uint64_t>(m_buffers.get() + static_cast<size_t>(bid) * buffer_size);
+		buf.len = buffer_size;
+		buf.bid = bid;
+		m_buf_tail++;
+	}
+
+	void uring_poller::publish_buffers() {
+		__atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+	}
+
+	int uring_poller::add_registration(int fd, kind type, uint32_t events, void* data) {
+		if (m_fds.count(fd) != 0) return EEXIST;
+		auto id = m_next_id++;
+		auto& reg = m_registrations[id];
+		reg.fd = fd;
+		reg.type = type;
+		reg.events = events;
+		reg.data = data;
+		m_fds[fd] = id;
+		queue_arm(id, reg);
+		return 0;
+	}
+
+	int uring_poller::add(int fd, uint32_t events, void* data) {
+		return add_registration(fd, kind::poll, events, data);
+	}
+
+	int uring_poller::add_listener(int fd, void* data) {
+		return add_registration(fd, kind::listener, readable, data);
+	}
+
+	int uring_poller::add_stream(int fd, void* data) {
+		return add_registration(fd, kind::stream, readable, data);
+	}
+
+	int uring_poller::modify(int fd, uint32_t events, void* data) {
+		auto it = m_fds.find(fd);
+		if (it == m_fds.end()) return ENOENT;
+		auto id = it->second;
+		auto& reg = m_registrations[id];
+		reg.data = data;
+		if (reg.events == events) return 0;
+		auto old = reg.events;
+		reg.events = events;
+		switch (reg.type) {
+		case kind::poll:
+			// Rearmed with the new mask once the cancellation completes
+			if (reg.armed) cancel(id, reg);
+			break;
+		case kind::stream:
+			if ((old & readable) && !(events & readable) && reg.armed)
+				cancel(id, reg);
+			else if (!(old & readable) && (events & readable))
+				queue_arm(id, reg);
+			// Writability of a stream means its send queue drained
+			if ((events & writable) && !(old & writable) && !reg.send_inflight && !reg.flush_queued) m_writable_queue.push_back(id);
+			break;
+		case kind::listener: break;
+		}
+		return 0;
+	}
+
+	void uring_poller::remove(int fd) {
+		auto it = m_fds.find(fd);
+		if (it == m_fds.end()) return;
+		auto id = it->second;
+		m_fds.erase(it);
+		auto& reg = m_registrations[id];
+		if (reg.armed) cancel(id, reg);
+		if (reg.send_inflight || !reg.pending.empty()) {
+			// The owner is about to close fd, keep a duplicate to finish sending queued data
+			reg.fd = dup(fd);
+			if (reg.fd >= 0) {
+				reg.orphaned = true;
+				reg.data = nullptr;
+				return;
+			}
+			if (reg.send_inflight) {
+				// The kernel still references the buffer, release it on completion
+				reg.orphaned = true;
+				reg.data = nullptr;
+				reg.pending.clear();
+				return;
+			}
+		}
+		m_registrations.erase(id);
+	}
+
+	void uring_poller::cancel(uint64_t id, const registration& reg) {
+		auto sqe = get_sqe();
+		if (!sqe) return;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = make_user_data(id, reg.type == kind::listener ? op_accept : reg.type == kind::stream ? op_recv : op_poll);
+		sqe->user_data = make_user_data(id, op_cancel);
+	}
+
+	size_t uring_poller::sendv(int fd, const iovec* iov, size_t count) {
+		auto it = m_fds.find(fd);
+		if (it == m_fds.end()) return poller::sendv(fd, iov, count);
+		auto& reg = m_registrations[it->second];
+		size_t len = 0;
+		for (size_t i = 0; i < count; i++) {
+			reg.pending.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+			len += iov[i].iov_len;
+		}
+		queue_flush(it->second, reg);
+		return len;
+	}
+
+	size_t uring_poller::pending(int fd) const noexcept {
+		auto it = m_fds.find(fd);
+		if (it == m_fds.end()) return 0;
+		auto& reg = m_registrations.at(it->second);
+		return reg.sending.size() - reg.sending_offset + reg.pending.size();
+	}
+
+	void uring_poller::queue_arm(uint64_t id, registration& reg) {
+		if (reg.arm_queued || reg.armed) return;
+		reg.arm_queued = true;
+		m_arm_queue.push_back(id);
+	}
+
+	void uring_poller::queue_flush(uint64_t id, registration& reg) {
+		if (reg.flush_queued || reg.send_inflight) return;
+		reg.flush_queued = true;
+		m_flush_queue.push_back(id);
+	}
+
+	void uring_poller::arm(uint64_t id, registration& reg) {
+		if (reg.armed || reg.orphaned) return;
+		if (reg.type == kind::stream && !(reg.events & readable)) return;
+		auto sqe = get_sqe();
+		if (!sqe) {
+			queue_arm(id, reg);
+			return;
+		}
+		sqe->fd = reg.fd;
+		switch (reg.type) {
+		case kind::listener:
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+			if (m_multishot_accept) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->user_data = make_user_data(id, op_accept);
+			break;
+		case kind::stream:
+			sqe->opcode = IORING_OP_RECV;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = 0;
+			if (m_multishot_recv)
+				sqe->ioprio = IORING_RECV_MULTISHOT;
+			else
+				sqe->len = buffer_size;
+			sqe->user_data = make_user_data(id, op_recv);
+			break;
+		case kind::poll:
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->poll32_events = to_poll_events(reg.events);
+			sqe->len = IORING_POLL_ADD_MULTI;
+			sqe->user_data = make_user_data(id, op_poll);
+			break;
+		}
+		reg.armed = true;
+	}
+
+	void uring_poller::flush(uint64_t id, registration& reg) {
+		if (reg.send_inflight) return;
+		if (reg.sending_offset >= reg.sending.size()) {
+			reg.sending.clear();
+			reg.sending_offset = 0;
+			if (reg.pending.empty()) return;
+			std::swap(reg.sending, reg.pending);
+		}
+		auto sqe = get_sqe();
+		if (!sqe) {
+			queue_flush(id, reg);
+			return;
+		}
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = reg.fd;
+		sqe->addr = reinterpret_cast<uint64_t>(reg.sending.data() + reg.sending_offset);
+		sqe->len = static_cast<uint32_t>(std::min<size_t>(reg.sending.size() - reg.sending_offset, UINT32_MAX));
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = make_user_data(id, op_send);
+		reg.send_inflight = true;
+	}
+
+	bool uring_poller::handle_completion(const io_uring_cqe& cqe, event& out) {
+		auto id = cqe.user_data >> 8;
+		auto type = static_cast<op>(cqe.user_data & 0xff);
+		bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+		bool has_buffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+		uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		if (type == op_cancel || type == op_wakeup) return false;
+
+		auto it = m_registrations.find(id);
+		if (it == m_registrations.end() || (it->second.orphaned && type != op_send)) {
+			// Completion for something already removed
+			if (has_buffer) recycle_buffer(bid);
+			if (type == op_accept && cqe.res >= 0) ::close(cqe.res);
+			return false;
+		}
+		auto& reg = it->second;
+		if (type != op_send && !more) {
+			reg.armed = false;
+			if (cqe.res != 0 || type != op_recv) queue_arm(id, reg);
+		}
+		out = event{reg.data, 0, 0, nullptr, 0};
+		switch (type) {
+		case op_accept:
+			if (cqe.res >= 0) {
+				out.events = accepted;
+				out.result = cqe.res;
+				return true;
+			}
+			if (cqe.res == -EINVAL && m_multishot_accept) m_multishot_accept = false;
+			return false;
+		case op_recv:
+			if (cqe.res > 0 && has_buffer) {
+				m_used_buffers.push_back(bid);
+				out.events = received;
+				out.buffer = m_buffers.get() + static_cast<size_t>(bid) * buffer_size;
+				out.length = static_cast<size_t>(cqe.res);
+				return true;
+			}
+			if (has_buffer) recycle_buffer(bid);
+			if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED) return false;
+			if (cqe.res == -EINVAL && m_multishot_recv) {
+				m_multishot_recv = false;
+				return false;
+			}
+			// End of stream or socket error
+			m_arm_queue.erase(std::remove(m_arm_queue.begin(), m_arm_queue.end(), id), m_arm_queue.end());
+			reg.arm_queued = false;
+			out.events = hangup;
+			out.result = cqe.res < 0 ? -cqe.res : 0;
+			return true;
+		case op_poll:
+			if (cqe.res < 0) return false;
+			if (cqe.res & (POLLIN | POLLPRI)) out.events |= readable;
+			if (cqe.res & POLLOUT) out.events |= writable;
+			if (cqe.res & (POLLHUP | POLLRDHUP | POLLERR)) out.events |= hangup | readable;
+			return out.events != 0;
+		case op_send:
+			reg.send_inflight = false;
+			if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+				queue_flush(id, reg);
+			} else if (cqe.res < 0) {
+				// Peer is gone, drop whatever is still queued
+				reg.sending.clear();
+				reg.sending_offset = 0;
+				reg.pending.clear();
+			} else {
+				reg.sending_offset += static_cast<size_t>(cqe.res);
+				if (reg.sending_offset < reg.sending.size() || !reg.pending.empty()) queue_flush(id, reg);
+			}
+			if (reg.orphaned) {
+				if (!reg.send_inflight && !reg.flush_queued) {
+					::close(reg.fd);
+					m_registrations.erase(it);
+				}
+				return false;
+			}
+			if (!(reg.events & writable)) return false;
+			out.events = writable;
+			return true;
+		default: return false;
+		}
+	}
+
+	void uring_poller::prepare() {
+		// Buffers handed out by the last call are no longer used by the caller
+		for (auto bid : m_used_buffers)
+			recycle_buffer(bid);
+		m_used_buffers.clear();
+		publish_buffers();
+
+		auto queue = std::move(m_arm_queue);
+		m_arm_queue.clear();
+		for (auto id : queue) {
+			auto it = m_registrations.find(id);
+			if (it == m_registrations.end()) continue;
+			it->second.arm_queued = false;
+			arm(id, it->second);
+		}
+		queue = std::move(m_flush_queue);
+		m_flush_queue.clear();
+		for (auto id : queue) {
+			auto it = m_registrations.find(id);
+			if (it == m_registrations.end()) continue;
+			it->second.flush_queued = false;
+			flush(id, it->second);
+		}
+	}
+
+	void uring_poller::submit() {
+		prepare();
+		// Writable events are generated by wait() itself, make sure it gets called
+		if (!m_writable_queue.empty()) {
+			if (auto sqe = get_sqe()) {
+				sqe->opcode = IORING_OP_NOP;
+				sqe->user_data = make_user_data(0, op_wakeup);
+			}
+		}
+		enter(0, 0);
+	}
+
+	int uring_poller::wait(event* out, size_t max, int timeout_ms) {
+		prepare();
+
+		size_t n = 0;
+		auto queue = std::move(m_writable_queue);
+		m_writable_queue.clear();
+		for (auto id : queue) {
+			auto it = m_registrations.find(id);
+			if (it == m_registrations.end() || it->second.orphaned || !(it->second.events & writable)) continue;
+			if (n == max) {
+				m_writable_queue.push_back(id);
+				continue;
+			}
+			out[n++] = event{it->second.data, writable, 0, nullptr, 0};
+		}
+
+		bool has_completions = n != 0 || *m_cq_head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+		if (enter(has_completions ? 0 : 1, timeout_ms) < 0) return -1;
+
+		unsigned head = *m_cq_head;
+		unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail && n < max) {
+			auto cqe = m_cqes[head & m_cq_mask];
+			head++;
+			if (handle_completion(cqe, out[n])) n++;
+		}
+		__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+		publish_buffers();
+		return static_cast<int>(n);
+	}
+} // namespace docker_plugin
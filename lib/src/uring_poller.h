@@ -0,0 +1,111 @@
+#pragma once
+#include "poller.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace docker_plugin {
+	/**
+	 * \brief io_uring based completion poller.
+	 *
+	 * Listening sockets are served by a multishot accept and streams by a multishot
+	 * recv selecting from a provided buffer ring. Outgoing data is queued per stream
+	 * and submitted as one send together with the next wait(), so a whole loop
+	 * iteration costs a single io_uring_enter. Kernels lacking multishot support
+	 * are handled by rearming single shot requests.
+	 */
+	class uring_poller : public poller {
+		uring_poller(const uring_poller&) = delete;
+		uring_poller& operator=(const uring_poller&) = delete;
+
+		enum class kind : uint8_t {
+			listener,
+			stream,
+			poll
+		};
+
+		struct registration {
+			int fd{-1};
+			kind type{kind::poll};
+			uint32_t events{};
+			void* data{};
+			// A (multishot) request is currently active in the kernel
+			bool armed{};
+			bool arm_queued{};
+			// Removed by the owner but kept alive until pending output is sent
+			bool orphaned{};
+			bool flush_queued{};
+			bool send_inflight{};
+			// Owned by the kernel while send_inflight is set
+			std::string sending{};
+			size_t sending_offset{};
+			std::string pending{};
+		};
+
+		static constexpr unsigned ring_entries = 256;
+		static constexpr unsigned buffer_count = 64;
+		static constexpr unsigned buffer_size = 16 * 1024;
+
+		int m_ring_fd{-1};
+		void* m_ring_ptr{};
+		size_t m_ring_size{};
+		io_uring_sqe* m_sqes{};
+		size_t m_sqes_size{};
+		unsigned* m_sq_head{};
+		unsigned* m_sq_tail{};
+		unsigned m_sq_mask{};
+		unsigned m_sq_entries{};
+		unsigned m_sq_local_tail{};
+		unsigned* m_cq_head{};
+		unsigned* m_cq_tail{};
+		unsigned m_cq_mask{};
+		io_uring_cqe* m_cqes{};
+
+		io_uring_buf_ring* m_buf_ring{};
+		size_t m_buf_ring_size{};
+		std::unique_ptr<char[]> m_buffers{};
+		uint16_t m_buf_tail{};
+
+		std::unordered_map<uint64_t, registration> m_registrations{};
+		std::unordered_map<int, uint64_t> m_fds{};
+		std::vector<uint64_t> m_arm_queue{};
+		std::vector<uint64_t> m_flush_queue{};
+		std::vector<uint64_t> m_writable_queue{};
+		std::vector<uint16_t> m_used_buffers{};
+		uint64_t m_next_id{1};
+		bool m_multishot_accept{true};
+		bool m_multishot_recv{true};
+
+		io_uring_sqe* get_sqe();
+		int enter(unsigned wait_nr, int timeout_ms);
+		int add_registration(int fd, kind type, uint32_t events, void* data);
+		void queue_arm(uint64_t id, registration& reg);
+		void queue_flush(uint64_t id, registration& reg);
+		void arm(uint64_t id, registration& reg);
+		void cancel(uint64_t id, const registration& reg);
+		void flush(uint64_t id, registration& reg);
+		void recycle_buffer(uint16_t bid);
+		void publish_buffers();
+		void prepare();
+		bool handle_completion(const io_uring_cqe& cqe, event& out);
+
+	public:
+		uring_poller();
+		~uring_poller();
+
+		int add(int fd, uint32_t events, void* data) override;
+		int add_listener(int fd, void* data) override;
+		int add_stream(int fd, void* data) override;
+		int modify(int fd, uint32_t events, void* data) override;
+		void remove(int fd) override;
+		int wait(event* out, size_t max, int timeout_ms) override;
+		size_t sendv(int fd, const iovec* iov, size_t count) override;
+		size_t pending(int fd) const noexcept override;
+		int get_fd() const noexcept override { return m_ring_fd; }
+		void submit() override;
+	};
+} // namespace docker_plugin
@@ -72,8 +72,10 @@ struct volume_plugin : driver {
 };
 
 int main() {
-	stdout_logger logger{};
-	logger.min_level = logger::level::trace;
+	stdout_logger out{};
+	out.min_level = logger::level::trace;
+	// Keep printing off the event loop
+	async_logger logger{out};
 	volume_plugin my_plugin;
 	my_plugin.m_root = util::cwd() + "/vols/";
 	if (!util::make_dirs(my_plugin.m_root)) {
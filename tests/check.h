@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdio>
+
+/**
+ * Minimal assertions for the unit tests, every test is a plain executable run by ctest.
+ * Failed checks are printed and counted, main() returns test_result() to report them.
+ */
+namespace docker_plugin::test {
+	inline int failures = 0;
+
+	inline void fail(const char* file, int line, const char* expr) {
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+		failures++;
+	}
+
+	inline int test_result() {
+		if (failures != 0) fprintf(stderr, "%d checks failed\n", failures);
+		return failures == 0 ? 0 : 1;
+	}
+} // namespace docker_plugin::test
+
+#define CHECK(expr)                                                     \
+	do {                                                                \
+		if (!(expr)) docker_plugin::test::fail(__FILE__, __LINE__, #expr); \
+	} while (false)
+
+#define CHECK_THROWS(expr, exception)                                                          \
+	do {                                                                                       \
+		bool thrown = false;                                                                   \
+		try {                                                                                  \
+			expr;                                                                              \
+		} catch (const exception&) { thrown = true; }                                          \
+		if (!thrown) docker_plugin::test::fail(__FILE__, __LINE__, #expr " throws " #exception); \
+	} while (false)
@@ -0,0 +1,121 @@
+#include "check.h"
+#include "serialize.h"
+#include <docker-plugin-cpp/ipam/api.h>
+#include <docker-plugin-cpp/network/api.h>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+using namespace docker_plugin;
+
+namespace {
+	const std::string hex = "4f0c0f6e1c2d4f3b9a8e7d6c5b4a39281706f5e4d3c2b1a09f8e7d6c5b4a3928";
+
+	void test_forms() {
+		docker_id id{hex};
+		CHECK(id.is_hex() && id.size() == 64 && id.str() == hex);
+		CHECK(id.bytes()[0] == 0x4f && id.bytes()[31] == 0x28);
+
+		// Upper case or non hex digits of the same length stay text
+		std::string upper = hex;
+		upper[0] = 'F';
+		docker_id text{upper};
+		CHECK(!text.is_hex() && text.str() == upper);
+		CHECK(text != docker_id{hex});
+
+		docker_id pool{"LocalDefault/172.18.0.0/16"};
+		CHECK(!pool.is_hex() && pool.size() == 26 && std::string(pool.text(), pool.size()) == "LocalDefault/172.18.0.0/16");
+
+		docker_id empty;
+		CHECK(empty.empty() && empty.size() == 0 && empty.str().empty());
+		CHECK(docker_id{""}.empty());
+	}
+
+	void test_long_ids() {
+		// Any length is kept, past the inline capacity the text moves to the heap
+		for (size_t len : {size_t{63}, size_t{64}, size_t{65}, size_t{200}, size_t{70000}}) {
+			std::string str(len, 'x');
+			str[len - 1] = 'y';
+			docker_id id{str};
+			CHECK(!id.is_hex() && id.size() == len && id.str() == str);
+			std::string formatted(len, '\0');
+			CHECK(id.format(&formatted[0]) == len && formatted == str);
+			CHECK(id == docker_id{str} && id.hash() == docker_id{str}.hash());
+			CHECK(id != docker_id{str.substr(0, len - 1)});
+		}
+
+		// The heap buffer is reused by shorter long ids and kept while the id is short
+		docker_id id{std::string(300, 'a')};
+		auto buffer = id.text();
+		id.assign(std::string(100, 'b').c_str(), 100);
+		CHECK(id.text() == buffer && id.str() == std::string(100, 'b'));
+		id = docker_id{"short"};
+		CHECK(id.str() == "short" && id.text() != buffer);
+		id.assign(std::string(250, 'c').c_str(), 250);
+		CHECK(id.text() == buffer && id.str() == std::string(250, 'c'));
+		id = docker_id{hex};
+		CHECK(id.is_hex() && id.str() == hex);
+	}
+
+	void test_copies() {
+		std::string long_text(100, 'l');
+		for (auto& str : {hex, std::string{"text"}, long_text}) {
+			docker_id id{str};
+			docker_id copy{id};
+			CHECK(copy == id && copy.str() == str);
+			docker_id assigned{"other"};
+			assigned = id;
+			CHECK(assigned == id && assigned.str() == str);
+			// Long text is copied, not shared
+			CHECK(id.is_hex() || copy.text() != id.text());
+
+			docker_id moved{std::move(copy)};
+			CHECK(moved == id && copy.empty());
+			docker_id target{std::string(90, 't')};
+			target = std::move(moved);
+			CHECK(target == id && target.str() == str && moved.empty());
+			// Moved from ids are usable
+			moved.assign("again", 5);
+			CHECK(moved.str() == "again");
+		}
+	}
+
+	void test_order_and_hash() {
+		// Ordered like the text, whatever the storage
+		std::string a(64, 'a'), b(64, 'b'), long_a(65, 'a');
+		docker_id ids[] = {docker_id{"0"}, docker_id{hex}, docker_id{a}, docker_id{long_a}, docker_id{b}, docker_id{"z"}};
+		for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+			for (size_t j = 0; j < sizeof(ids) / sizeof(ids[0]); j++)
+				CHECK((ids[i] < ids[j]) == (ids[i].str() < ids[j].str()));
+		}
+
+		std::unordered_set<docker_id> set{docker_id{hex}, docker_id{long_a}, docker_id{"pool"}};
+		CHECK(set.count(docker_id{hex}) == 1 && set.count(docker_id{long_a}) == 1 && set.count(docker_id{"pool"}) == 1);
+		CHECK(set.count(docker_id{a}) == 0);
+	}
+
+	void test_json() {
+		// Ids round trip through requests and responses at any length
+		std::string long_id(500, 'n');
+		network::create_network_request req;
+		from_json(R"({"NetworkID":")" + long_id + R"(","Options":{}})", req);
+		CHECK(req.network_id.str() == long_id);
+		from_json(R"({"NetworkID":")" + hex + R"("})", req);
+		CHECK(req.network_id.is_hex() && req.network_id.str() == hex);
+
+		ipam::request_pool_response res;
+		res.pool_id = docker_id{long_id};
+		CHECK(to_json(res).find(R"("PoolID":")" + long_id + '"') != std::string::npos);
+		res.pool_id = docker_id{hex};
+		CHECK(to_json(res).find(R"("PoolID":")" + hex + '"') != std::string::npos);
+	}
+} // namespace
+
+int main() {
+	test_forms();
+	test_long_ids();
+	test_copies();
+	test_order_and_hash();
+	test_json();
+	return test::test_result();
+}
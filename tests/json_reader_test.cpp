@@ -0,0 +1,143 @@
+#include "check.h"
+#include "json_reader.h"
+#include "serialize.h"
+#include <docker-plugin-cpp/volume/api.h>
+#include <stdexcept>
+#include <string>
+
+using namespace docker_plugin;
+
+namespace {
+	std::string read_string(const std::string& doc) {
+		json_reader rd{doc};
+		std::string res;
+		CHECK(rd.read(res));
+		return res;
+	}
+
+	std::string nested(size_t depth) { return std::string(depth, '[') + std::string(depth, ']'); }
+
+	void test_escapes() {
+		CHECK(read_string(R"("plain")") == "plain");
+		CHECK(read_string(R"("\"\\\/\b\f\n\r\t")") == "\"\\/\b\f\n\r\t");
+		CHECK(read_string(R"("\u0061\u0041\u00e9\u20AC")") == "aA\xc3\xa9\xe2\x82\xac");
+		// Surrogate pairs combine into a single four byte sequence
+		CHECK(read_string(R"("\ud83d\ude00")") == "\xf0\x9f\x98\x80");
+		CHECK(read_string(R"("\uD83D\uDE00")") == "\xf0\x9f\x98\x80");
+
+		CHECK_THROWS(read_string(R"("\x")"), std::invalid_argument);
+		CHECK_THROWS(read_string(R"("\u12")"), std::invalid_argument);
+		CHECK_THROWS(read_string(R"("\u12g4")"), std::invalid_argument);
+		CHECK_THROWS(read_string(R"("\ud83d")"), std::invalid_argument);
+		CHECK_THROWS(read_string(R"("\ud83dA")"), std::invalid_argument);
+		CHECK_THROWS(read_string(R"("\ude00")"), std::invalid_argument);
+
+		// Escaped member names and views are decoded into the reader's own storage
+		std::string doc = R"({"Name":"x\ty","plain":"z"})";
+		json_reader rd{doc};
+		rd.begin_object();
+		std::string_view key;
+		CHECK(rd.next_member(key) && key == "Name");
+		std::string_view value;
+		CHECK(rd.read(value) && value == "x\ty");
+		CHECK(rd.next_member(key) && key == "plain");
+		CHECK(rd.read(value) && value == "z");
+		CHECK(value.data() > doc.data() && value.data() < doc.data() + doc.size());
+		CHECK(!rd.next_member(key));
+	}
+
+	void test_nesting_limit() {
+		auto skip = [](const std::string& doc) {
+			json_reader rd{doc};
+			rd.skip();
+		};
+		skip(nested(100));
+		skip(R"({"a":)" + nested(99) + "}");
+		CHECK_THROWS(skip(nested(101)), std::invalid_argument);
+		CHECK_THROWS(skip(R"({"a":)" + nested(100) + "}"), std::invalid_argument);
+
+		// Unknown members are skipped with the same limit
+		volume::create_request req;
+		from_json(R"({"Name":"a","Deep":)" + nested(100) + "}", req);
+		CHECK(req.name == "a");
+		CHECK_THROWS(from_json(R"({"Name":"a","Deep":)" + nested(101) + "}", req), std::invalid_argument);
+	}
+
+	void test_wrong_types() {
+		std::string doc = R"([5, "s", true, null, {"a":[1,{"b":"c"}]}, 7])";
+		json_reader rd{doc};
+		rd.begin_array();
+		std::string str = "kept";
+		bool flag = false;
+		int64_t num = 0;
+		CHECK(rd.next_element() && !rd.read(str) && str == "kept");
+		CHECK(rd.next_element() && !rd.read(num) && num == 0);
+		CHECK(rd.next_element() && !rd.read(str) && str == "kept");
+		CHECK(rd.next_element() && !rd.read(flag) && !flag);
+		CHECK(rd.next_element() && !rd.read(str) && str == "kept");
+		CHECK(rd.next_element() && rd.read(num) && num == 7);
+		CHECK(!rd.next_element());
+
+		// Members of the wrong type are skipped and the field keeps its default
+		volume::create_request req;
+		req.name = "old";
+		req.options.emplace("stale", "value");
+		from_json(R"({"Name":5,"Opts":"x","Other":{"Name":"inner"}})", req);
+		CHECK(req.name.empty());
+		CHECK(req.options.empty());
+		from_json(R"({"Name":"vol","Opts":{"size":"1G","count":3,"flag":true,"list":["a"],"mode":"ro"}})", req);
+		CHECK(req.name == "vol");
+		CHECK(req.options.size() == 2);
+		CHECK(req.options.count("size") == 1 && req.options.at("size") == "1G");
+		CHECK(req.options.count("mode") == 1 && req.options.at("mode") == "ro");
+
+		// Only integers that fit an int64 are read as such
+		std::string big = "[9223372036854775807, 9223372036854775808, -9223372036854775808, 1.5, 1e3]";
+		json_reader nums{big};
+		nums.begin_array();
+		CHECK(nums.next_element() && nums.read(num) && num == INT64_MAX);
+		CHECK(nums.next_element() && !nums.read(num));
+		CHECK(nums.next_element() && nums.read(num) && num == INT64_MIN);
+		CHECK(nums.next_element() && !nums.read(num));
+		CHECK(nums.next_element() && !nums.read(num));
+		CHECK(!nums.next_element());
+	}
+
+	void test_malformed() {
+		volume::mount_request req;
+		const char* docs[] = {
+			"",
+			"   ",
+			"[]",
+			"\"Name\"",
+			"{",
+			R"({"Name")",
+			R"({"Name":)",
+			R"({"Name" "a"})",
+			R"({"Name":"a",})",
+			R"({"Name":"a" "ID":"b"})",
+			R"({"Name":"a)",
+			R"({Name:"a"})",
+			R"({"Name":tru})",
+			R"({"Name":nul})",
+			R"({"Name":-})",
+			R"({"Name":1.})",
+			R"({"Name":1e})",
+			R"({"Name":[1,2})",
+			R"({"Name":{"a":1]})",
+		};
+		for (auto doc : docs)
+			CHECK_THROWS(from_json(doc, req), std::invalid_argument);
+
+		from_json(R"( {"Name" : "a" , "ID":"b"} )", req);
+		CHECK(req.name == "a" && req.id == "b");
+	}
+} // namespace
+
+int main() {
+	test_escapes();
+	test_nesting_limit();
+	test_wrong_types();
+	test_malformed();
+	return test::test_result();
+}
@@ -0,0 +1,183 @@
+#include "check.h"
+#include <algorithm>
+#include <docker-plugin-cpp/small_map.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace docker_plugin;
+
+namespace {
+	// Counts live instances, the copy numbered throw_at throws
+	struct tracked {
+		static int live;
+		static int copies;
+		static int throw_at;
+		int value;
+
+		tracked(int v = 0)
+			: value{v} { live++; }
+		tracked(const tracked& other)
+			: value{other.value} {
+			if (++copies == throw_at) throw std::runtime_error("copy failed");
+			live++;
+		}
+		tracked(tracked&& other) noexcept
+			: value{other.value} { live++; }
+		tracked& operator=(const tracked&) = default;
+		tracked& operator=(tracked&&) noexcept = default;
+		~tracked() { live--; }
+	};
+	int tracked::live = 0;
+	int tracked::copies = 0;
+	int tracked::throw_at = 0;
+	using tracked_map = small_map<int, tracked, 2>;
+	using plain_map = std::unordered_map<std::string, std::string>;
+
+	std::string key(int i) {
+		char buf[16];
+		snprintf(buf, sizeof(buf), "key%04d", i);
+		return buf;
+	}
+
+	template <typename TMap>
+	bool is_sorted(const TMap& map) {
+		return std::is_sorted(map.begin(), map.end(), [](auto& lhs, auto& rhs) { return lhs.first < rhs.first; });
+	}
+
+	void test_growth() {
+		string_map map;
+		CHECK(map.capacity() == 4);
+		auto inline_data = map.begin();
+		for (int i = 0; i < 4; i++)
+			map.emplace(key(i), std::to_string(i));
+		CHECK(map.begin() == inline_data);
+		CHECK(map.capacity() == 4);
+		// The fifth entry moves everything to the heap
+		map.emplace(key(4), "4");
+		CHECK(map.begin() != inline_data);
+		CHECK(map.capacity() == 8);
+		for (int i = 5; i < 100; i++)
+			map[key(i)] = std::to_string(i);
+		CHECK(map.size() == 100);
+		CHECK(map.capacity() >= 100);
+		CHECK(is_sorted(map));
+		for (int i = 0; i < 100; i++)
+			CHECK(map.count(key(i)) == 1 && map.at(key(i)) == std::to_string(i));
+
+		// Clearing keeps the heap array for reuse
+		auto capacity = map.capacity();
+		map.clear();
+		CHECK(map.empty() && map.capacity() == capacity);
+		map.emplace(key(1), "1");
+		CHECK(map.size() == 1 && map.at(key(1)) == "1");
+	}
+
+	void test_moves() {
+		// Inline entries are moved one by one, the source ends up empty
+		string_map small{{"b", "2"}, {"a", "1"}};
+		auto moved = std::move(small);
+		CHECK(small.empty() && small.capacity() == 4);
+		CHECK(moved.size() == 2 && moved.begin()->first == "a" && moved.at("b") == "2");
+
+		// Heap arrays change owner without touching the entries
+		string_map large;
+		for (int i = 0; i < 10; i++)
+			large.emplace(key(i), std::to_string(i));
+		auto data = large.begin();
+		string_map target{{"x", "y"}};
+		target = std::move(large);
+		CHECK(target.begin() == data && target.size() == 10);
+		CHECK(large.empty() && large.capacity() == 4);
+		CHECK(target.count("x") == 0 && target.at(key(9)) == "9");
+
+		// A map that gave away its entries is usable again, in both directions
+		large = std::move(moved);
+		CHECK(large.size() == 2 && large.at("a") == "1");
+		moved.emplace("c", "3");
+		CHECK(moved.size() == 1 && moved.at("c") == "3");
+
+		// Copies are independent
+		string_map copy = target;
+		copy[key(0)] = "changed";
+		CHECK(target.at(key(0)) == "0" && copy.at(key(0)) == "changed");
+		CHECK(copy.size() == target.size());
+		copy = large;
+		CHECK(copy == large && copy.capacity() >= 2);
+	}
+
+	void test_inserts() {
+		std::vector<int> order(200);
+		for (int i = 0; i < 200; i++)
+			order[i] = i;
+		std::mt19937 rng{42};
+		for (int round = 0; round < 3; round++) {
+			// In order, reversed and shuffled
+			if (round == 1) std::reverse(order.begin(), order.end());
+			if (round == 2) std::shuffle(order.begin(), order.end(), rng);
+			string_map map;
+			for (int i : order)
+				CHECK(map.emplace(key(i), std::to_string(i)).second);
+			CHECK(map.size() == 200);
+			CHECK(is_sorted(map));
+			for (int i = 0; i < 200; i++)
+				CHECK(map.find(key(i)) != map.end() && map.find(key(i))->second == std::to_string(i));
+			CHECK(map.find("key") == map.end() && map.find("zzz") == map.end());
+
+			// Existing keys are kept by emplace and replaced by insert_or_assign
+			CHECK(!map.emplace(key(order[0]), "other").second);
+			CHECK(map.at(key(order[0])) == std::to_string(order[0]));
+			CHECK(!map.insert_or_assign(key(order[1]), "other").second);
+			CHECK(map.at(key(order[1])) == "other");
+			CHECK(map.size() == 200);
+
+			for (int i = 0; i < 200; i += 2)
+				CHECK(map.erase(key(i)) == 1);
+			CHECK(map.erase(key(0)) == 0);
+			CHECK(map.size() == 100 && is_sorted(map));
+		}
+
+		// Conversions keep the content
+		plain_map plain{{"b", "2"}, {"a", "1"}, {"c", "3"}};
+		string_map converted{plain};
+		CHECK(converted.size() == 3 && is_sorted(converted));
+		CHECK(static_cast<plain_map>(converted) == plain);
+	}
+
+	void test_copy_exception() {
+		tracked_map source;
+		for (int i = 0; i < 6; i++)
+			source.emplace(i, tracked{i});
+		auto live = tracked::live;
+
+		// Fails on the fourth entry, into an inline and into a heap map
+		for (int initial : {0, 5}) {
+			{
+				tracked_map target;
+				for (int i = 0; i < initial; i++)
+					target.emplace(10 + i, tracked{i});
+				tracked::copies = 0;
+				tracked::throw_at = 4;
+				CHECK_THROWS(target = source, std::runtime_error);
+				CHECK(target.size() == 3);
+				CHECK(tracked::live == live + 3);
+			}
+			CHECK(tracked::live == live);
+		}
+
+		tracked::copies = 0;
+		tracked::throw_at = 2;
+		CHECK_THROWS(tracked_map{source}, std::runtime_error);
+		CHECK(tracked::live == live);
+		tracked::throw_at = 0;
+	}
+} // namespace
+
+int main() {
+	test_growth();
+	test_moves();
+	test_inserts();
+	test_copy_exception();
+	return test::test_result();
+}
@@ -0,0 +1,183 @@
+#include "check.h"
+#include "timer_wheel.h"
+#include <memory>
+#include <vector>
+
+using namespace docker_plugin;
+
+namespace {
+	// Long enough that no real time passes during a test, schedule() counts from tick 0 or the last advance()
+	constexpr std::chrono::milliseconds resolution{1000};
+	// Ticks covered by the four levels of 64 slots
+	constexpr uint64_t range = uint64_t{1} << 24;
+
+	struct fixture {
+		timer_wheel wheel{resolution};
+		std::chrono::steady_clock::time_point start{};
+		// Tick at which each timer fired, by the id given to schedule()
+		std::vector<std::pair<int, uint64_t>> fired{};
+
+		fixture() {
+			// A timer without delay is due at tick 1, which reveals where tick 0 started
+			timer probe;
+			wheel.schedule(probe, std::chrono::milliseconds{0}, []() {});
+			start = wheel.next_expiry() - resolution;
+		}
+
+		std::chrono::steady_clock::time_point at(uint64_t tick) const { return start + resolution * static_cast<int64_t>(tick); }
+
+		// Arm t to fire at the given tick, timers are due at the tick following their delay
+		void schedule(timer& t, int id, uint64_t due) {
+			wheel.schedule(t, resolution * static_cast<int64_t>(due - wheel.tick() - 1), [this, id]() { fired.emplace_back(id, wheel.tick()); });
+		}
+
+		size_t advance(uint64_t tick) {
+			return wheel.advance(at(tick), [](void*, const std::function<void()>& fn) { fn(); });
+		}
+	};
+
+	void test_block_boundaries() {
+		const uint64_t due[] = {1, 63, 64, 65, 127, 128, 4095, 4096, 4097, 262143, 262144, 262145, range - 1, range};
+		// Once in a single jump and once tick by tick up to the second level boundary
+		for (bool step : {false, true}) {
+			fixture f;
+			std::vector<std::unique_ptr<timer>> timers;
+			for (size_t i = 0; i < sizeof(due) / sizeof(due[0]); i++) {
+				timers.emplace_back(new timer{});
+				f.schedule(*timers.back(), static_cast<int>(i), due[i]);
+			}
+			if (step) {
+				for (uint64_t tick = 1; tick <= 4097; tick++)
+					f.advance(tick);
+			}
+			f.advance(range);
+			CHECK(f.fired.size() == sizeof(due) / sizeof(due[0]));
+			for (size_t i = 0; i < f.fired.size(); i++)
+				CHECK(f.fired[i].first == static_cast<int>(i) && f.fired[i].second == due[i]);
+			CHECK(f.wheel.empty());
+		}
+	}
+
+	void test_not_early() {
+		// Every timer is still pending one tick before it is due
+		for (uint64_t due : {uint64_t{64}, uint64_t{4096}, uint64_t{262144}, range}) {
+			fixture f;
+			timer t;
+			f.schedule(t, 0, due);
+			CHECK(f.advance(due - 1) == 0);
+			CHECK(t.armed());
+			CHECK(f.wheel.next_expiry() <= f.at(due));
+			CHECK(f.advance(due) == 1);
+			CHECK(!t.armed());
+		}
+	}
+
+	void test_beyond_range() {
+		fixture f;
+		timer far, farther;
+		f.schedule(far, 1, range + 5);
+		f.schedule(farther, 2, 3 * range + 7);
+		CHECK(f.advance(range + 4) == 0);
+		CHECK(f.advance(3 * range + 6) == 1);
+		CHECK(f.fired.size() == 1 && f.fired[0].second == range + 5);
+		CHECK(farther.armed());
+		CHECK(f.advance(3 * range + 7) == 1);
+		CHECK(f.fired.size() == 2 && f.fired[1].first == 2 && f.fired[1].second == 3 * range + 7);
+		CHECK(f.wheel.empty());
+	}
+
+	void test_cancel_in_handler() {
+		fixture f;
+		timer a, b, c;
+		// All in the same slot, whichever fires first cancels the others
+		auto cancel_others = [&]() {
+			f.fired.emplace_back(0, f.wheel.tick());
+			a.cancel();
+			b.cancel();
+			c.cancel();
+		};
+		f.wheel.schedule(a, resolution * 9, cancel_others);
+		f.wheel.schedule(b, resolution * 9, cancel_others);
+		f.wheel.schedule(c, resolution * 9, cancel_others);
+		CHECK(f.advance(10) == 1);
+		CHECK(f.fired.size() == 1 && f.fired[0].second == 10);
+		CHECK(!a.armed() && !b.armed() && !c.armed());
+		CHECK(f.wheel.empty());
+		CHECK(f.wheel.next_expiry() == std::chrono::steady_clock::time_point::max());
+
+		// A handler may destroy its own timer and others due in the same tick
+		auto owned = std::make_unique<timer>();
+		auto other = std::make_unique<timer>();
+		f.wheel.schedule(*owned, resolution * 4, [&]() {
+			owned.reset();
+			other.reset();
+		});
+		f.schedule(*other, 1, 15);
+		CHECK(f.advance(100) == 1);
+		CHECK(!owned && !other);
+		CHECK(f.wheel.empty());
+	}
+
+	void test_reschedule_in_handler() {
+		fixture f;
+		timer periodic, moved, same_tick;
+		int count = 0;
+		std::function<void()> tick_fn = [&]() {
+			f.fired.emplace_back(0, f.wheel.tick());
+			if (++count < 5) f.wheel.schedule(periodic, resolution * 99, tick_fn);
+		};
+		f.wheel.schedule(periodic, resolution * 99, tick_fn);
+		f.wheel.schedule(same_tick, resolution * 99, [&]() {
+			f.fired.emplace_back(2, f.wheel.tick());
+			f.schedule(moved, 1, 5000);
+		});
+		// Due in the same tick, but pushed back by the handler before it
+		f.schedule(moved, 1, 100);
+		CHECK(f.advance(10000) == 7);
+		std::vector<std::pair<int, uint64_t>> expected = {{0, 100}, {2, 100}, {0, 200}, {0, 300}, {0, 400}, {0, 500}, {1, 5000}};
+		CHECK(f.fired == expected);
+		CHECK(f.wheel.empty());
+
+		// Rescheduling to the current tick fires in the next one, not again right away
+		fixture g;
+		timer t;
+		std::function<void()> again = [&]() {
+			g.fired.emplace_back(0, g.wheel.tick());
+			if (g.fired.size() < 3) g.wheel.schedule(t, std::chrono::milliseconds{0}, again);
+		};
+		g.wheel.schedule(t, resolution * 63, again);
+		CHECK(g.advance(64) == 1);
+		CHECK(g.advance(66) == 2);
+		expected = {{0, 64}, {0, 65}, {0, 66}};
+		CHECK(g.fired == expected);
+	}
+
+	void test_idle_jumps() {
+		fixture f;
+		// Nothing armed, advancing far ahead only moves the clock
+		CHECK(f.advance(1000000) == 0);
+		CHECK(f.wheel.tick() == 1000000);
+		CHECK(f.wheel.next_wakeup(f.at(1000000)) == std::chrono::milliseconds::max());
+
+		// Delays count from the tick reached, and long gaps are jumped over in one step
+		timer t;
+		f.wheel.schedule(t, resolution * 999999, [&]() { f.fired.emplace_back(0, f.wheel.tick()); });
+		CHECK(f.wheel.next_expiry() <= f.at(2000000));
+		CHECK(f.wheel.next_wakeup(f.at(2000000)) == std::chrono::milliseconds{0});
+		CHECK(f.advance(1999999) == 0);
+		CHECK(f.wheel.tick() == 1999999);
+		CHECK(f.advance(5000000) == 1);
+		CHECK(f.fired.size() == 1 && f.fired[0].second == 2000000);
+		CHECK(f.wheel.tick() == 5000000);
+	}
+} // namespace
+
+int main() {
+	test_block_boundaries();
+	test_not_early();
+	test_beyond_range();
+	test_cancel_in_handler();
+	test_reschedule_in_handler();
+	test_idle_jumps();
+	return test::test_result();
+}
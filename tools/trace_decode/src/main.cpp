@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <docker-plugin-cpp/trace.h>
+
+using namespace docker_plugin;
+
+namespace {
+	std::string escape(const char* str, size_t max) {
+		std::string res;
+		for (size_t i = 0; i < max && str[i] != '\0'; i++) {
+			auto c = static_cast<unsigned char>(str[i]);
+			if (c == '"' || c == '\\') {
+				res += '\\';
+				res += static_cast<char>(c);
+			} else if (c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				res += buf;
+			} else
+				res += static_cast<char>(c);
+		}
+		return res;
+	}
+
+	void print(const trace_record& rec) {
+		printf("{\"seq\":%llu,\"timestamp_ns\":%llu,\"route\":\"%s\",\"fd\":%d,\"status\":%u,\"request_size\":%u,\"response_size\":%u,\"duration_ns\":%llu}\n",
+			   static_cast<unsigned long long>(rec.seq - 1), static_cast<unsigned long long>(rec.timestamp_ns), escape(rec.route, sizeof(rec.route)).c_str(),
+			   rec.fd, static_cast<unsigned>(rec.status), static_cast<unsigned>(rec.request_size), static_cast<unsigned>(rec.response_size),
+			   static_cast<unsigned long long>(rec.duration_ns));
+	}
+} // namespace
+
+int main(int argc, const char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <trace file>\nPrints all records in the trace as json lines, oldest first.\n", argv[0]);
+		return 1;
+	}
+	int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	struct stat st {};
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(trace_file_header)) {
+		fprintf(stderr, "%s is not a trace file\n", argv[1]);
+		return 1;
+	}
+	// Mapped so a trace can be read while the plugin keeps writing it
+	auto map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	auto header = static_cast<const trace_file_header*>(map);
+	if (memcmp(header->magic, trace_file_header::magic_value(), sizeof(header->magic)) != 0 || header->version != trace_file_header::current_version ||
+		header->record_size != sizeof(trace_record) || header->capacity == 0 ||
+		// Divided rather than multiplied, a corrupt capacity must not wrap around
+		header->capacity > (static_cast<size_t>(st.st_size) - sizeof(trace_file_header)) / sizeof(trace_record)) {
+		fprintf(stderr, "%s is not a trace file or has an unsupported version\n", argv[1]);
+		return 1;
+	}
+	auto records = reinterpret_cast<const trace_record*>(static_cast<const char*>(map) + sizeof(trace_file_header));
+	auto next = __atomic_load_n(&header->next, __ATOMIC_ACQUIRE);
+	auto first = next > header->capacity ? next - header->capacity : 0;
+	for (auto i = first; i < next; i++) {
+		auto& slot = records[i % header->capacity];
+		// Copy and check the sequence again, the writer might have overwritten the slot meanwhile
+		if (__atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) != i + 1) continue;
+		trace_record rec;
+		memcpy(&rec, &slot, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot.seq, __ATOMIC_RELAXED) != i + 1 || rec.seq != i + 1) continue;
+		print(rec);
+	}
+	munmap(map, st.st_size);
+	return 0;
+}